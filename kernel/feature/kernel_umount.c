@@ -1,5 +1,6 @@
 static bool ksu_kernel_umount_enabled __read_mostly = true;
 static bool ksu_webview_zygote_umount_enabled = true;
+static bool ksu_kernel_umount_defer_enabled __read_mostly = false;
 
 bool ksu_is_webview_zygote_umount_enabled(void)
 {
@@ -48,32 +49,590 @@ static const struct ksu_feature_handler webview_zygote_umount_handler = {
 	.set_handler = webview_zygote_umount_feature_set,
 };
 
+static int kernel_umount_defer_feature_get(u64 *value)
+{
+	*value = READ_ONCE(ksu_kernel_umount_defer_enabled) ? 1 : 0;
+	return 0;
+}
+
+static int kernel_umount_defer_feature_set(u64 value)
+{
+	bool enable = value != 0;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 5, 0)
+	if (enable)
+		return -EOPNOTSUPP;
+#endif
+	WRITE_ONCE(ksu_kernel_umount_defer_enabled, enable);
+	pr_info("kernel_umount_defer: set to %d\n", enable);
+	return 0;
+}
+
+static const struct ksu_feature_handler kernel_umount_defer_handler = {
+	.feature_id = KSU_FEATURE_KERNEL_UMOUNT_DEFER,
+	.name = "kernel_umount_defer",
+	.get_handler = kernel_umount_defer_feature_get,
+	.set_handler = kernel_umount_defer_feature_set,
+};
+
 extern int path_umount(struct path *path, int flags);
 
-static inline void ksu_umount_mnt(const char *mnt, struct path *path, int flags)
+static inline int ksu_umount_mnt(const char *mnt, struct path *path, int flags)
 {
 	int err = path_umount(path, flags);
 	if (err)
 		pr_info("umount %s failed: %d\n", mnt, err);
+	return err;
 }
 
-static inline void try_umount(const char *mnt, int flags)
+// *mounted tells whether mnt was a mountpoint in the current namespace
+static inline int try_umount(const char *mnt, int flags, bool *mounted)
 {
 	struct path path;
 	int err = kern_path(mnt, 0, &path);
+
+	*mounted = false;
 	if (err) {
-		return;
+		return err;
 	}
 
 	if (path.dentry != path.mnt->mnt_root) {
 		// it is not root mountpoint, maybe umounted by others already.
 		path_put(&path);
+		return -EINVAL;
+	}
+
+	*mounted = true;
+	return ksu_umount_mnt(mnt, &path, flags);
+}
+
+#ifdef CONFIG_KSU_UMOUNT_STATS
+struct ksu_umount_counters *ksu_umount_counters_new(void)
+{
+	struct ksu_umount_counters *counters = kzalloc(sizeof(*counters), GFP_KERNEL);
+
+	if (counters)
+		atomic_set(&counters->users, 1);
+	return counters;
+}
+
+void ksu_umount_counters_put(struct ksu_umount_counters *counters)
+{
+	if (counters && atomic_dec_and_test(&counters->users))
+		kfree(counters);
+}
+
+static void ksu_umount_counters_account(struct ksu_umount_counters *counters, int err, u64 ns)
+{
+	atomic64_inc(&counters->attempts);
+	atomic64_add(ns, &counters->ns);
+	if (!err)
+		atomic64_inc(&counters->successes);
+	else if (err == -ENOENT)
+		atomic64_inc(&counters->enoent);
+	else if (err == -EINVAL)
+		atomic64_inc(&counters->einval);
+}
+#endif
+
+/*
+ * Flat snapshot of mount_list, rebuilt on the first fork after the list
+ * changed. Forks walk it without mount_list_lock. The mounts themselves are
+ * not pinned: an extra vfsmount reference would turn every umount into -EBUSY.
+ */
+struct ksu_umount_step {
+	const char *path;
+	unsigned int flags;
+#ifdef CONFIG_KSU_UMOUNT_STATS
+	struct ksu_umount_counters *counters;
+#endif
+};
+
+struct ksu_umount_plan {
+	atomic_t users;
+	int gen;
+	u32 count;
+	struct ksu_umount_step steps[];
+};
+
+static DEFINE_SPINLOCK(ksu_umount_plan_lock);
+static DEFINE_MUTEX(ksu_umount_plan_build_lock);
+static struct ksu_umount_plan *ksu_umount_plan;
+static atomic_t ksu_umount_list_gen = ATOMIC_INIT(0);
+
+void ksu_umount_list_changed(void)
+{
+	atomic_inc(&ksu_umount_list_gen);
+}
+
+static void ksu_umount_plan_put(struct ksu_umount_plan *plan)
+{
+	if (plan && atomic_dec_and_test(&plan->users)) {
+#ifdef CONFIG_KSU_UMOUNT_STATS
+		u32 i;
+
+		for (i = 0; i < plan->count; i++)
+			ksu_umount_counters_put(plan->steps[i].counters);
+#endif
+		kfree(plan);
+	}
+}
+
+// returns a referenced plan when it matches gen
+static struct ksu_umount_plan *ksu_umount_plan_get_current(int gen)
+{
+	struct ksu_umount_plan *plan;
+
+	spin_lock(&ksu_umount_plan_lock);
+	plan = ksu_umount_plan;
+	if (plan && plan->gen == gen)
+		atomic_inc(&plan->users);
+	else
+		plan = NULL;
+	spin_unlock(&ksu_umount_plan_lock);
+
+	return plan;
+}
+
+static struct ksu_umount_plan *ksu_umount_plan_build(int gen)
+{
+	struct ksu_umount_plan *plan;
+	struct mount_entry *entry;
+	size_t count = 0;
+	size_t strings = 0;
+	char *cursor;
+	u32 i = 0;
+
+	down_read(&mount_list_lock);
+	list_for_each_entry (entry, &mount_list, list) {
+		count++;
+		strings += strlen(entry->umountable) + 1;
+	}
+
+	// steps and the path strings share one allocation
+	plan = kmalloc(sizeof(*plan) + count * sizeof(struct ksu_umount_step) + strings, GFP_KERNEL);
+	if (!plan) {
+		up_read(&mount_list_lock);
+		return NULL;
+	}
+
+	cursor = (char *)&plan->steps[count];
+	list_for_each_entry (entry, &mount_list, list) {
+		size_t len = strlen(entry->umountable) + 1;
+
+		memcpy(cursor, entry->umountable, len);
+		plan->steps[i].path = cursor;
+		plan->steps[i].flags = entry->flags;
+#ifdef CONFIG_KSU_UMOUNT_STATS
+		atomic_inc(&entry->counters->users);
+		plan->steps[i].counters = entry->counters;
+#endif
+		cursor += len;
+		i++;
+	}
+	up_read(&mount_list_lock);
+
+	atomic_set(&plan->users, 1);
+	plan->gen = gen;
+	plan->count = i;
+	return plan;
+}
+
+static struct ksu_umount_plan *ksu_umount_plan_get(void)
+{
+	struct ksu_umount_plan *plan, *old;
+	int gen = atomic_read(&ksu_umount_list_gen);
+
+	plan = ksu_umount_plan_get_current(gen);
+	if (likely(plan))
+		return plan;
+
+	mutex_lock(&ksu_umount_plan_build_lock);
+	// another fork may have rebuilt it while we waited
+	gen = atomic_read(&ksu_umount_list_gen);
+	plan = ksu_umount_plan_get_current(gen);
+	if (plan)
+		goto out_unlock;
+
+	plan = ksu_umount_plan_build(gen);
+	if (!plan)
+		goto out_unlock;
+
+	// one reference for the cache, one for the caller
+	atomic_inc(&plan->users);
+	spin_lock(&ksu_umount_plan_lock);
+	old = ksu_umount_plan;
+	ksu_umount_plan = plan;
+	spin_unlock(&ksu_umount_plan_lock);
+	ksu_umount_plan_put(old);
+
+out_unlock:
+	mutex_unlock(&ksu_umount_plan_build_lock);
+	return plan;
+}
+
+/*
+ * Apps get a private copy of their zygote's mount namespace, so which steps
+ * find a mountpoint only depends on that zygote. Remember the hit steps per
+ * (zygote, zygote mnt_ns) and replay just those. The zygote is held by its
+ * struct pid so a recycled tgid can't match, and its entry goes away with it.
+ * ksud mounting more (post-fs-data, module mount, boot completed) goes through
+ * ksu_umount_list_changed(), which retires every entry.
+ *
+ * Anything else mounted into the zygote namespace later (service scripts,
+ * root apps, remounts) is not seen: a subset is stale until the list
+ * changes. So this is opt-in through kernel_umount_ns_cache, off by default.
+ */
+#define KSU_UMOUNT_NS_SLOTS 4
+
+static bool ksu_umount_ns_cache_enabled __read_mostly = false;
+
+struct ksu_umount_ns_cache {
+	atomic_t users;
+	const void *mnt_ns;
+	struct pid *source;
+	int gen;
+	unsigned long stamp;
+	u32 present;
+	u32 steps[];
+};
+
+static DEFINE_SPINLOCK(ksu_umount_ns_lock);
+static struct ksu_umount_ns_cache *ksu_umount_ns_caches[KSU_UMOUNT_NS_SLOTS];
+
+static atomic64_t ksu_umount_ns_hits = ATOMIC64_INIT(0);
+static atomic64_t ksu_umount_ns_misses = ATOMIC64_INIT(0);
+static atomic64_t ksu_umount_ns_skipped = ATOMIC64_INIT(0);
+static atomic64_t ksu_umount_ns_avoided = ATOMIC64_INIT(0);
+
+void ksu_umount_get_cache_stats(struct ksu_umount_cache_stats *stats)
+{
+	stats->hits = atomic64_read(&ksu_umount_ns_hits);
+	stats->misses = atomic64_read(&ksu_umount_ns_misses);
+	stats->skipped = atomic64_read(&ksu_umount_ns_skipped);
+	stats->avoided = atomic64_read(&ksu_umount_ns_avoided);
+}
+
+static void ksu_umount_ns_put(struct ksu_umount_ns_cache *cache)
+{
+	if (cache && atomic_dec_and_test(&cache->users)) {
+		put_pid(cache->source);
+		kfree(cache);
+	}
+}
+
+// returns a referenced pid of the parent's thread group
+static struct pid *ksu_umount_source_ns(const void **mnt_ns)
+{
+	struct task_struct *parent;
+	struct pid *source = NULL;
+
+	rcu_read_lock();
+	parent = rcu_dereference(current->real_parent);
+	task_lock(parent);
+	if (parent->nsproxy) {
+		*mnt_ns = parent->nsproxy->mnt_ns;
+		source = get_pid(task_tgid(parent));
+	}
+	task_unlock(parent);
+	rcu_read_unlock();
+
+	return source;
+}
+
+static bool ksu_umount_ns_source_dead(struct ksu_umount_ns_cache *cache)
+{
+	bool dead;
+
+	rcu_read_lock();
+	dead = !pid_task(cache->source, PIDTYPE_PID);
+	rcu_read_unlock();
+
+	return dead;
+}
+
+// also drops the entries whose zygote has exited
+static struct ksu_umount_ns_cache *ksu_umount_ns_get(const void *mnt_ns, struct pid *source, int gen)
+{
+	struct ksu_umount_ns_cache *dead[KSU_UMOUNT_NS_SLOTS];
+	struct ksu_umount_ns_cache *found = NULL;
+	struct ksu_umount_ns_cache *cache;
+	int ndead = 0;
+	int i;
+
+	spin_lock(&ksu_umount_ns_lock);
+	for (i = 0; i < KSU_UMOUNT_NS_SLOTS; i++) {
+		cache = ksu_umount_ns_caches[i];
+		if (!cache)
+			continue;
+		if (cache->source != source && ksu_umount_ns_source_dead(cache)) {
+			ksu_umount_ns_caches[i] = NULL;
+			dead[ndead++] = cache;
+			continue;
+		}
+		if (!found && cache->source == source && cache->mnt_ns == mnt_ns && cache->gen == gen) {
+			atomic_inc(&cache->users);
+			found = cache;
+		}
+	}
+	spin_unlock(&ksu_umount_ns_lock);
+
+	for (i = 0; i < ndead; i++)
+		ksu_umount_ns_put(dead[i]);
+
+	return found;
+}
+
+// replaces the slot of the same source, else an empty or the oldest one
+static void ksu_umount_ns_store(struct ksu_umount_ns_cache *fresh)
+{
+	struct ksu_umount_ns_cache *cache, *old;
+	int victim = 0;
+	int i;
+
+	spin_lock(&ksu_umount_ns_lock);
+	for (i = 0; i < KSU_UMOUNT_NS_SLOTS; i++) {
+		cache = ksu_umount_ns_caches[i];
+		if (!cache || cache->source == fresh->source) {
+			victim = i;
+			break;
+		}
+		if (time_before(cache->stamp, ksu_umount_ns_caches[victim]->stamp))
+			victim = i;
+	}
+	old = ksu_umount_ns_caches[victim];
+	ksu_umount_ns_caches[victim] = fresh;
+	spin_unlock(&ksu_umount_ns_lock);
+
+	ksu_umount_ns_put(old);
+}
+
+static void ksu_umount_ns_clear(void);
+
+static int kernel_umount_ns_cache_feature_get(u64 *value)
+{
+	*value = READ_ONCE(ksu_umount_ns_cache_enabled) ? 1 : 0;
+	return 0;
+}
+
+static int kernel_umount_ns_cache_feature_set(u64 value)
+{
+	bool enable = value != 0;
+
+	WRITE_ONCE(ksu_umount_ns_cache_enabled, enable);
+	// subsets recorded before the toggle may be stale already
+	ksu_umount_ns_clear();
+	pr_info("kernel_umount_ns_cache: set to %d\n", enable);
+	return 0;
+}
+
+static const struct ksu_feature_handler kernel_umount_ns_cache_handler = {
+	.feature_id = KSU_FEATURE_KERNEL_UMOUNT_NS_CACHE,
+	.name = "kernel_umount_ns_cache",
+	.get_handler = kernel_umount_ns_cache_feature_get,
+	.set_handler = kernel_umount_ns_cache_feature_set,
+};
+
+static void ksu_umount_ns_clear(void)
+{
+	struct ksu_umount_ns_cache *old[KSU_UMOUNT_NS_SLOTS];
+	int i;
+
+	spin_lock(&ksu_umount_ns_lock);
+	for (i = 0; i < KSU_UMOUNT_NS_SLOTS; i++) {
+		old[i] = ksu_umount_ns_caches[i];
+		ksu_umount_ns_caches[i] = NULL;
+	}
+	spin_unlock(&ksu_umount_ns_lock);
+
+	for (i = 0; i < KSU_UMOUNT_NS_SLOTS; i++)
+		ksu_umount_ns_put(old[i]);
+}
+
+// returns whether the step found a mountpoint
+static bool ksu_umount_step_run(const struct ksu_umount_step *step)
+{
+	bool mounted;
+#ifdef CONFIG_KSU_UMOUNT_STATS
+	u64 start = ktime_get_ns();
+	int err;
+#endif
+
+	pr_info("%s: unmounting: %s flags: 0x%x\n", __func__, step->path, step->flags);
+#ifdef CONFIG_KSU_UMOUNT_STATS
+	err = try_umount(step->path, step->flags, &mounted);
+	ksu_umount_counters_account(step->counters, err, ktime_get_ns() - start);
+#else
+	try_umount(step->path, step->flags, &mounted);
+#endif
+
+	return mounted;
+}
+
+static void ksu_umount_run_plan(struct ksu_umount_plan *plan)
+{
+	struct ksu_umount_ns_cache *cache = NULL;
+	struct ksu_umount_ns_cache *fresh = NULL;
+	const void *mnt_ns = NULL;
+	struct pid *source;
+	u32 i;
+
+	if (!READ_ONCE(ksu_umount_ns_cache_enabled)) {
+		for (i = 0; i < plan->count; i++)
+			ksu_umount_step_run(&plan->steps[i]);
+		return;
+	}
+
+	source = ksu_umount_source_ns(&mnt_ns);
+	if (source)
+		cache = ksu_umount_ns_get(mnt_ns, source, plan->gen);
+
+	if (cache) {
+		atomic64_inc(&ksu_umount_ns_hits);
+		atomic64_add(plan->count - cache->present, &ksu_umount_ns_avoided);
+		if (!cache->present)
+			atomic64_inc(&ksu_umount_ns_skipped);
+
+		for (i = 0; i < cache->present; i++)
+			ksu_umount_step_run(&plan->steps[cache->steps[i]]);
+		ksu_umount_ns_put(cache);
+		put_pid(source);
 		return;
 	}
 
-	ksu_umount_mnt(mnt, &path, flags);
+	atomic64_inc(&ksu_umount_ns_misses);
+	if (source) {
+		fresh = kmalloc(sizeof(*fresh) + plan->count * sizeof(u32), GFP_KERNEL);
+		if (fresh) {
+			atomic_set(&fresh->users, 1);
+			fresh->mnt_ns = mnt_ns;
+			// the entry owns the reference from here on
+			fresh->source = source;
+			fresh->gen = plan->gen;
+			fresh->present = 0;
+		} else {
+			put_pid(source);
+		}
+	}
+
+	for (i = 0; i < plan->count; i++) {
+		if (ksu_umount_step_run(&plan->steps[i]) && fresh)
+			fresh->steps[fresh->present++] = i;
+	}
+
+	if (fresh) {
+		fresh->stamp = jiffies;
+		ksu_umount_ns_store(fresh);
+	}
 }
 
+static void ksu_umount_current(void)
+{
+	const struct cred *saved = override_creds(ksu_cred);
+
+	struct ksu_umount_plan *plan = ksu_umount_plan_get();
+	if (likely(plan)) {
+		ksu_umount_run_plan(plan);
+		ksu_umount_plan_put(plan);
+	} else {
+		// no memory for a plan, walk the list directly
+		struct mount_entry *entry;
+
+		down_read(&mount_list_lock);
+		list_for_each_entry (entry, &mount_list, list) {
+			struct ksu_umount_step step = {
+				.path = entry->umountable,
+				.flags = entry->flags,
+#ifdef CONFIG_KSU_UMOUNT_STATS
+				.counters = entry->counters,
+#endif
+			};
+
+			ksu_umount_step_run(&step);
+		}
+		up_read(&mount_list_lock);
+	}
+
+	revert_creds(saved);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 5, 0)
+/*
+ * Runs when the app returns from setresuid, before it gets to execute any
+ * of its own code, but outside of the credential switch. Every queued
+ * callback holds a module reference, so the module can't be unloaded
+ * under it; a task that never returns to userspace only makes rmmod fail.
+ */
+#define KSU_UMOUNT_DRAIN_MS 1000
+
+static atomic_t ksu_umount_tw_pending = ATOMIC_INIT(0);
+
+static void ksu_umount_tw_func(struct callback_head *cb)
+{
+	kfree(cb);
+	ksu_umount_current();
+	atomic_dec(&ksu_umount_tw_pending);
+	// last thing we do, only the return is left after the pin is gone
+	module_put(THIS_MODULE);
+}
+
+static bool ksu_umount_defer(void)
+{
+	struct callback_head *cb;
+
+	if (!READ_ONCE(ksu_kernel_umount_defer_enabled))
+		return false;
+
+	// module is going away, umount right here instead
+	if (!try_module_get(THIS_MODULE))
+		return false;
+
+	cb = kmalloc(sizeof(*cb), GFP_KERNEL);
+	if (!cb) {
+		module_put(THIS_MODULE);
+		return false;
+	}
+
+	init_task_work(cb, ksu_umount_tw_func);
+	atomic_inc(&ksu_umount_tw_pending);
+	if (task_work_add(current, cb, TWA_RESUME)) {
+		// task is exiting, nothing will run there anyway
+		atomic_dec(&ksu_umount_tw_pending);
+		kfree(cb);
+		module_put(THIS_MODULE);
+	}
+
+	return true;
+}
+
+/*
+ * The module references keep exit from running while callbacks are queued,
+ * only a forced unload gets here with some left. Wait a bounded time for
+ * those instead of hanging on a task that is stopped or traced.
+ */
+static void ksu_umount_defer_drain(void)
+{
+	unsigned int waited = 0;
+
+	WRITE_ONCE(ksu_kernel_umount_defer_enabled, false);
+	while (atomic_read(&ksu_umount_tw_pending) && waited < KSU_UMOUNT_DRAIN_MS) {
+		msleep(10);
+		waited += 10;
+	}
+	if (atomic_read(&ksu_umount_tw_pending))
+		pr_warn("kernel_umount: %d deferred umounts still queued at exit\n",
+			atomic_read(&ksu_umount_tw_pending));
+}
+#else
+static inline bool ksu_umount_defer(void)
+{
+	return false;
+}
+
+static inline void ksu_umount_defer_drain(void)
+{
+}
+#endif
+
 static inline int ksu_handle_umount(struct cred *new, const struct cred *old)
 {
 	uid_t new_uid = ksu_get_uid_t(new->uid);
@@ -111,17 +670,8 @@ static inline int ksu_handle_umount(struct cred *new, const struct cred *old)
 	// umount the target mnt
 	pr_info("handle umount for uid: %d, pid: %d\n", new_uid, current->pid);
 
-	const struct cred *saved = override_creds(ksu_cred);
-
-	struct mount_entry *entry;
-	down_read(&mount_list_lock);
-	list_for_each_entry (entry, &mount_list, list) {
-		pr_info("%s: unmounting: %s flags: 0x%x\n", __func__, entry->umountable, entry->flags);
-		try_umount(entry->umountable, entry->flags);
-	}
-	up_read(&mount_list_lock);
-
-	revert_creds(saved);
+	if (!ksu_umount_defer())
+		ksu_umount_current();
 
 	return 0;
 }
@@ -134,10 +684,28 @@ void __init ksu_kernel_umount_init(void)
 	if (ksu_register_feature_handler(&webview_zygote_umount_handler)) {
 		pr_err("Failed to register webview_zygote_umount feature handler\n");
 	}
+	if (ksu_register_feature_handler(&kernel_umount_defer_handler)) {
+		pr_err("Failed to register kernel_umount_defer feature handler\n");
+	}
+	if (ksu_register_feature_handler(&kernel_umount_ns_cache_handler)) {
+		pr_err("Failed to register kernel_umount_ns_cache feature handler\n");
+	}
 }
 
 void __exit ksu_kernel_umount_exit(void)
 {
+	struct ksu_umount_plan *plan;
+
+	ksu_unregister_feature_handler(KSU_FEATURE_KERNEL_UMOUNT_NS_CACHE);
+	ksu_unregister_feature_handler(KSU_FEATURE_KERNEL_UMOUNT_DEFER);
 	ksu_unregister_feature_handler(KSU_FEATURE_WEBVIEW_ZYGOTE_UMOUNT);
 	ksu_unregister_feature_handler(KSU_FEATURE_KERNEL_UMOUNT);
+	ksu_umount_defer_drain();
+
+	spin_lock(&ksu_umount_plan_lock);
+	plan = ksu_umount_plan;
+	ksu_umount_plan = NULL;
+	spin_unlock(&ksu_umount_plan_lock);
+	ksu_umount_plan_put(plan);
+	ksu_umount_ns_clear();
 }
@@ -1,15 +1,39 @@
 #ifndef __KSU_H_KERNEL_UMOUNT
 #define __KSU_H_KERNEL_UMOUNT
 
+#ifdef CONFIG_KSU_UMOUNT_STATS
+// shared by a mount_entry and the plan steps copied from it
+struct ksu_umount_counters {
+    atomic_t users;
+    atomic64_t attempts;
+    atomic64_t successes;
+    atomic64_t enoent;
+    atomic64_t einval;
+    atomic64_t ns;
+};
+
+struct ksu_umount_counters *ksu_umount_counters_new(void);
+void ksu_umount_counters_put(struct ksu_umount_counters *counters);
+#endif
+
 // for the umount list
 struct mount_entry {
     char *umountable;
     unsigned int flags;
     struct list_head list;
+    struct hlist_node hnode; // mount_hash, keyed by path hash
+    u32 hash;
+#ifdef CONFIG_KSU_UMOUNT_STATS
+    struct ksu_umount_counters *counters;
+#endif
 };
 extern struct list_head mount_list;
 extern struct rw_semaphore mount_list_lock;
 
 bool ksu_is_webview_zygote_umount_enabled(void);
+// call after changing mount_list or mounting more, the umount plan and
+// the per-zygote subsets are rebuilt on next use
+void ksu_umount_list_changed(void);
+void ksu_umount_get_cache_stats(struct ksu_umount_cache_stats *stats);
 
 #endif
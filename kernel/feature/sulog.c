@@ -22,6 +22,106 @@ static const struct ksu_feature_handler sulog_handler = {
 	.set_handler = sulog_feature_set,
 };
 
+static int sulog_coalesce_feature_get(u64 *value)
+{
+	*value = READ_ONCE(ksu_sulog_get_queue()->coalesce) ? 1 : 0;
+	return 0;
+}
+
+static int sulog_coalesce_feature_set(u64 value)
+{
+	bool enable = value != 0;
+
+	ksu_event_queue_set_coalesce(ksu_sulog_get_queue(), enable);
+	pr_info("sulog: coalesce set to %d\n", enable);
+	return 0;
+}
+
+static const struct ksu_feature_handler sulog_coalesce_handler = {
+	.feature_id = KSU_FEATURE_SULOG_COALESCE,
+	.name = "sulog_coalesce",
+	.get_handler = sulog_coalesce_feature_get,
+	.set_handler = sulog_coalesce_feature_set,
+};
+
+static int sulog_max_queued_feature_get(u64 *value)
+{
+	*value = READ_ONCE(ksu_sulog_get_queue()->max_queued);
+	return 0;
+}
+
+static int sulog_max_queued_feature_set(u64 value)
+{
+	int ret;
+
+	if (value > U32_MAX)
+		return -EINVAL;
+
+	ret = ksu_sulog_set_max_queued((__u32)value);
+	if (!ret)
+		pr_info("sulog: max_queued set to %llu\n", value);
+	return ret;
+}
+
+static const struct ksu_feature_handler sulog_max_queued_handler = {
+	.feature_id = KSU_FEATURE_SULOG_MAX_QUEUED,
+	.name = "sulog_max_queued",
+	.get_handler = sulog_max_queued_feature_get,
+	.set_handler = sulog_max_queued_feature_set,
+};
+
+static int sulog_max_payload_feature_get(u64 *value)
+{
+	*value = READ_ONCE(ksu_sulog_get_queue()->max_payload_len);
+	return 0;
+}
+
+static int sulog_max_payload_feature_set(u64 value)
+{
+	int ret;
+
+	if (value > U32_MAX)
+		return -EINVAL;
+
+	ret = ksu_sulog_set_max_payload_len((__u32)value);
+	if (!ret)
+		pr_info("sulog: max_payload set to %llu\n", value);
+	return ret;
+}
+
+static const struct ksu_feature_handler sulog_max_payload_handler = {
+	.feature_id = KSU_FEATURE_SULOG_MAX_PAYLOAD,
+	.name = "sulog_max_payload",
+	.get_handler = sulog_max_payload_feature_get,
+	.set_handler = sulog_max_payload_feature_set,
+};
+
+static int sulog_clock_feature_get(u64 *value)
+{
+	*value = READ_ONCE(ksu_sulog_get_queue()->clock_id);
+	return 0;
+}
+
+static int sulog_clock_feature_set(u64 value)
+{
+	int ret;
+
+	if (value > U32_MAX)
+		return -EINVAL;
+
+	ret = ksu_event_queue_set_clock(ksu_sulog_get_queue(), (__u32)value);
+	if (!ret)
+		pr_info("sulog: clock set to %llu\n", value);
+	return ret;
+}
+
+static const struct ksu_feature_handler sulog_clock_handler = {
+	.feature_id = KSU_FEATURE_SULOG_CLOCK,
+	.name = "sulog_clock",
+	.get_handler = sulog_clock_feature_get,
+	.set_handler = sulog_clock_feature_set,
+};
+
 bool ksu_sulog_is_enabled(void)
 {
 	return ksu_sulog_enabled;
@@ -47,10 +147,30 @@ void __init ksu_sulog_init(void)
 	}
 
 	ksu_sulog_fd_init();
+
+	ret = ksu_register_feature_handler(&sulog_coalesce_handler);
+	if (ret)
+		pr_err("Failed to register sulog_coalesce feature handler\n");
+
+	ret = ksu_register_feature_handler(&sulog_max_queued_handler);
+	if (ret)
+		pr_err("Failed to register sulog_max_queued feature handler\n");
+
+	ret = ksu_register_feature_handler(&sulog_max_payload_handler);
+	if (ret)
+		pr_err("Failed to register sulog_max_payload feature handler\n");
+
+	ret = ksu_register_feature_handler(&sulog_clock_handler);
+	if (ret)
+		pr_err("Failed to register sulog_clock feature handler\n");
 }
 
 void __exit ksu_sulog_exit(void)
 {
+	ksu_unregister_feature_handler(KSU_FEATURE_SULOG_CLOCK);
+	ksu_unregister_feature_handler(KSU_FEATURE_SULOG_MAX_PAYLOAD);
+	ksu_unregister_feature_handler(KSU_FEATURE_SULOG_MAX_QUEUED);
+	ksu_unregister_feature_handler(KSU_FEATURE_SULOG_COALESCE);
 	ksu_sulog_fd_exit();
 	ksu_sulog_events_exit();
 	ksu_unregister_feature_handler(KSU_FEATURE_SULOG);
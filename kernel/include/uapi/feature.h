@@ -8,6 +8,12 @@ enum ksu_feature_id {
 	KSU_FEATURE_ADB_ROOT = 3,
 	KSU_FEATURE_SELINUX_HIDE = 4,
 	KSU_FEATURE_WEBVIEW_ZYGOTE_UMOUNT = 5,
+	KSU_FEATURE_SULOG_COALESCE = 6,
+	KSU_FEATURE_SULOG_MAX_QUEUED = 7,
+	KSU_FEATURE_SULOG_MAX_PAYLOAD = 8,
+	KSU_FEATURE_SULOG_CLOCK = 9,
+	KSU_FEATURE_KERNEL_UMOUNT_DEFER = 10,
+	KSU_FEATURE_KERNEL_UMOUNT_NS_CACHE = 11,
 
 	KSU_FEATURE_MAX
 };
@@ -1,9 +1,30 @@
 struct ksu_event_queue_node {
 	struct list_head list;
+	/* Producer supplied coalescing key, 0 never coalesces. */
+	__u64 key;
+	/* Set while the reader copies this node out, it must not change under it. */
+	bool claimed;
 	struct ksu_event_record_hdr hdr;
 	__u8 payload[];
 };
 
+static __u64 ksu_event_queue_clock_ns(__u32 clock_id)
+{
+	switch (clock_id) {
+	case KSU_EVENT_CLOCK_BOOTTIME:
+		return ktime_get_boottime_ns();
+	case KSU_EVENT_CLOCK_MONO_FAST:
+		return ktime_get_mono_fast_ns();
+	default:
+		return ktime_get_ns();
+	}
+}
+
+static __u16 ksu_event_queue_clock_flags(__u32 clock_id)
+{
+	return (clock_id << KSU_EVENT_RECORD_CLOCK_SHIFT) & KSU_EVENT_RECORD_CLOCK_MASK;
+}
+
 static size_t ksu_event_queue_record_size(__u32 payload_len)
 {
 	return sizeof(struct ksu_event_record_hdr) + payload_len;
@@ -50,6 +71,9 @@ void ksu_event_queue_init(struct ksu_event_queue *queue, __u32 max_queued, __u32
 	queue->dropped_inflight = 0;
 	queue->dropped_inflight_first_seq = 0;
 	queue->dropped_inflight_last_seq = 0;
+	queue->coalesced_total = 0;
+	queue->clock_id = KSU_EVENT_CLOCK_MONOTONIC;
+	queue->coalesce = false;
 	queue->closed = false;
 }
 
@@ -80,15 +104,102 @@ void ksu_event_queue_destroy(struct ksu_event_queue *queue)
 	wake_up_interruptible_poll(&queue->read_wait, EPOLLHUP | POLLHUP);
 }
 
+void ksu_event_queue_set_coalesce(struct ksu_event_queue *queue, bool coalesce)
+{
+	unsigned long irq_flags;
+
+	spin_lock_irqsave(&queue->lock, irq_flags);
+	queue->coalesce = coalesce;
+	spin_unlock_irqrestore(&queue->lock, irq_flags);
+}
+
+int ksu_event_queue_set_clock(struct ksu_event_queue *queue, __u32 clock_id)
+{
+	if (clock_id > KSU_EVENT_CLOCK_MAX) {
+		return -EINVAL;
+	}
+
+	WRITE_ONCE(queue->clock_id, clock_id);
+	return 0;
+}
+
+/*
+ * Shrinking never discards records that are already queued: pushes are
+ * dropped (and accounted as such) until the reader drains below the new
+ * limit, so seq ranges in the dropped records stay exact. Each setter only
+ * touches its own limit, so concurrent updates of the two don't undo
+ * each other.
+ */
+void ksu_event_queue_set_max_queued(struct ksu_event_queue *queue, __u32 max_queued)
+{
+	unsigned long irq_flags;
+
+	spin_lock_irqsave(&queue->lock, irq_flags);
+	WRITE_ONCE(queue->max_queued, max_queued);
+	spin_unlock_irqrestore(&queue->lock, irq_flags);
+}
+
+void ksu_event_queue_set_max_payload_len(struct ksu_event_queue *queue, __u32 max_payload_len)
+{
+	unsigned long irq_flags;
+
+	spin_lock_irqsave(&queue->lock, irq_flags);
+	WRITE_ONCE(queue->max_payload_len, max_payload_len);
+	spin_unlock_irqrestore(&queue->lock, irq_flags);
+}
+
+/*
+ * Fold the record into the newest pending one when type, length and key match.
+ * Only the repeat count changes, so no allocation and no new seq are needed.
+ */
+static bool ksu_event_queue_try_coalesce(struct ksu_event_queue *queue, __u16 type, __u32 len, __u64 key)
+{
+	struct ksu_event_queue_node *tail;
+	unsigned long irq_flags;
+	__u16 repeat;
+	bool merged = false;
+
+	spin_lock_irqsave(&queue->lock, irq_flags);
+	if (queue->closed || !queue->coalesce || list_empty(&queue->pending)) {
+		goto out_unlock;
+	}
+
+	tail = list_entry(queue->pending.prev, struct ksu_event_queue_node, list);
+	if (tail->claimed || tail->key != key || tail->hdr.type != type || tail->hdr.len != len) {
+		goto out_unlock;
+	}
+
+	repeat = (tail->hdr.flags & KSU_EVENT_RECORD_REPEAT_MASK) >> KSU_EVENT_RECORD_REPEAT_SHIFT;
+	if (repeat >= KSU_EVENT_RECORD_REPEAT_MAX) {
+		goto out_unlock;
+	}
+
+	repeat++;
+	tail->hdr.flags = (tail->hdr.flags & ~KSU_EVENT_RECORD_REPEAT_MASK) | (repeat << KSU_EVENT_RECORD_REPEAT_SHIFT);
+	queue->coalesced_total++;
+	merged = true;
+
+out_unlock:
+	spin_unlock_irqrestore(&queue->lock, irq_flags);
+	return merged;
+}
+
 int ksu_event_queue_push(struct ksu_event_queue *queue, __u16 type, __u16 flags, const void *payload, __u32 len, gfp_t gfp)
+{
+	return ksu_event_queue_push_keyed(queue, type, flags, payload, len, 0, gfp);
+}
+
+int ksu_event_queue_push_keyed(struct ksu_event_queue *queue, __u16 type, __u16 flags, const void *payload, __u32 len,
+			       __u64 key, gfp_t gfp)
 {
 	struct ksu_event_queue_node *node = NULL;
 	unsigned long irq_flags;
+	__u32 clock_id;
 	__u64 seq;
 	bool wake = false;
 	int ret = 0;
 
-	if (len > queue->max_payload_len) {
+	if (len > READ_ONCE(queue->max_payload_len)) {
 		return -EMSGSIZE;
 	}
 
@@ -96,14 +207,26 @@ int ksu_event_queue_push(struct ksu_event_queue *queue, __u16 type, __u16 flags,
 		return -EINVAL;
 	}
 
+	if (key && READ_ONCE(queue->coalesce) && ksu_event_queue_try_coalesce(queue, type, len, key)) {
+		return 0;
+	}
+
 	node = kmalloc(struct_size(node, payload, len), gfp);
 
 	if (node) {
+		/*
+		 * Take the timestamp here, outside the irq-off section. Records
+		 * racing on other cpus may end up with ts_ns slightly out of seq
+		 * order, seq stays authoritative for ordering.
+		 */
+		clock_id = READ_ONCE(queue->clock_id);
 		INIT_LIST_HEAD(&node->list);
+		node->key = key;
+		node->claimed = false;
 		node->hdr.type = type;
-		node->hdr.flags = flags;
+		node->hdr.flags = (flags & ~KSU_EVENT_RECORD_CLOCK_MASK) | ksu_event_queue_clock_flags(clock_id);
 		node->hdr.len = len;
-		node->hdr.ts_ns = 0;
+		node->hdr.ts_ns = ksu_event_queue_clock_ns(clock_id);
 		node->hdr.seq = 0;
 
 		if (len) {
@@ -126,7 +249,6 @@ int ksu_event_queue_push(struct ksu_event_queue *queue, __u16 type, __u16 flags,
 	}
 
 	node->hdr.seq = seq;
-	node->hdr.ts_ns = ktime_get_ns();
 	list_add_tail(&node->list, &queue->pending);
 	queue->queued++;
 	wake = true;
@@ -205,10 +327,10 @@ static ssize_t ksu_event_queue_read_drop(struct ksu_event_queue *queue, char __u
 	}
 
 	hdr.type = KSU_EVENT_QUEUE_TYPE_DROPPED;
-	hdr.flags = KSU_EVENT_RECORD_FLAG_INTERNAL;
+	hdr.flags = KSU_EVENT_RECORD_FLAG_INTERNAL | ksu_event_queue_clock_flags(queue->clock_id);
 	hdr.len = sizeof(info);
 	hdr.seq = queue->dropped_first_seq;
-	hdr.ts_ns = ktime_get_ns();
+	hdr.ts_ns = ksu_event_queue_clock_ns(queue->clock_id);
 
 	info.dropped = queue->dropped_pending;
 	info.first_seq = queue->dropped_first_seq;
@@ -258,6 +380,7 @@ out_restore:
 
 static ssize_t ksu_event_queue_read_node(struct ksu_event_queue *queue, char __user *buf, size_t count)
 {
+	struct ksu_event_record_hdr hdr;
 	struct ksu_event_queue_node *node;
 	struct list_head *first;
 	size_t record_size;
@@ -276,14 +399,16 @@ static ssize_t ksu_event_queue_read_node(struct ksu_event_queue *queue, char __u
 		spin_unlock_irqrestore(&queue->lock, irq_flags);
 		return -EMSGSIZE;
 	}
+	node->claimed = true;
+	hdr = node->hdr;
 	spin_unlock_irqrestore(&queue->lock, irq_flags);
 
-	if (copy_to_user(buf, &node->hdr, sizeof(node->hdr))) {
-		return -EFAULT;
+	if (copy_to_user(buf, &hdr, sizeof(hdr))) {
+		goto out_unclaim;
 	}
 
-	if (node->hdr.len && copy_to_user(buf + sizeof(node->hdr), node->payload, node->hdr.len)) {
-		return -EFAULT;
+	if (hdr.len && copy_to_user(buf + sizeof(hdr), node->payload, hdr.len)) {
+		goto out_unclaim;
 	}
 
 	spin_lock_irqsave(&queue->lock, irq_flags);
@@ -293,6 +418,13 @@ static ssize_t ksu_event_queue_read_node(struct ksu_event_queue *queue, char __u
 
 	kfree(node);
 	return record_size;
+
+out_unclaim:
+	spin_lock_irqsave(&queue->lock, irq_flags);
+	node->claimed = false;
+	spin_unlock_irqrestore(&queue->lock, irq_flags);
+
+	return -EFAULT;
 }
 
 ssize_t ksu_event_queue_read(struct ksu_event_queue *queue, char __user *buf, size_t count, int file_flags)
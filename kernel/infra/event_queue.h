@@ -2,6 +2,17 @@
 #define KSU_EVENT_QUEUE_H
 
 #define KSU_EVENT_RECORD_FLAG_INTERNAL (1U << 0)
+/* Bits 1-2 of flags tell which clock ts_ns was taken from. */
+#define KSU_EVENT_RECORD_CLOCK_SHIFT 1
+#define KSU_EVENT_RECORD_CLOCK_MASK (0x3U << KSU_EVENT_RECORD_CLOCK_SHIFT)
+#define KSU_EVENT_CLOCK_MONOTONIC 0U
+#define KSU_EVENT_CLOCK_BOOTTIME 1U
+#define KSU_EVENT_CLOCK_MONO_FAST 2U
+#define KSU_EVENT_CLOCK_MAX KSU_EVENT_CLOCK_MONO_FAST
+/* Upper 12 bits of flags count identical records folded into this one. */
+#define KSU_EVENT_RECORD_REPEAT_SHIFT 4
+#define KSU_EVENT_RECORD_REPEAT_MAX 0xFFFU
+#define KSU_EVENT_RECORD_REPEAT_MASK (KSU_EVENT_RECORD_REPEAT_MAX << KSU_EVENT_RECORD_REPEAT_SHIFT)
 #define KSU_EVENT_QUEUE_TYPE_DROPPED ((__u16)0xFFFF)
 
 struct ksu_event_record_hdr {
@@ -35,6 +46,9 @@ struct ksu_event_queue {
 	__u64 dropped_inflight;
 	__u64 dropped_inflight_first_seq;
 	__u64 dropped_inflight_last_seq;
+	__u64 coalesced_total;
+	__u32 clock_id;
+	bool coalesce;
 	bool closed;
 };
 
@@ -43,6 +57,12 @@ void ksu_event_queue_destroy(struct ksu_event_queue *queue);
 
 int ksu_event_queue_push(struct ksu_event_queue *queue, __u16 type, __u16 flags, const void *payload, __u32 len,
 						 gfp_t gfp);
+int ksu_event_queue_push_keyed(struct ksu_event_queue *queue, __u16 type, __u16 flags, const void *payload, __u32 len,
+						 __u64 key, gfp_t gfp);
+void ksu_event_queue_set_coalesce(struct ksu_event_queue *queue, bool coalesce);
+int ksu_event_queue_set_clock(struct ksu_event_queue *queue, __u32 clock_id);
+void ksu_event_queue_set_max_queued(struct ksu_event_queue *queue, __u32 max_queued);
+void ksu_event_queue_set_max_payload_len(struct ksu_event_queue *queue, __u32 max_payload_len);
 void ksu_event_queue_drop(struct ksu_event_queue *queue);
 
 ssize_t ksu_event_queue_read(struct ksu_event_queue *queue, char __user *buf, size_t count, int file_flags);
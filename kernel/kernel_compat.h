@@ -469,6 +469,12 @@ __weak void groups_sort(struct group_info *group_info) { } // no-op
 #if LINUX_VERSION_CODE < KERNEL_VERSION (3, 17, 0)
 static inline u64 ksu_ktime_get_ns(void) { return ktime_to_ns(ktime_get()); }
 #define ktime_get_ns ksu_ktime_get_ns
+static inline u64 ksu_ktime_get_boottime_ns(void) { return ktime_to_ns(ktime_get_boottime()); }
+#define ktime_get_boottime_ns ksu_ktime_get_boottime_ns
+// no NMI-safe fast accessor yet
+#define ktime_get_mono_fast_ns ksu_ktime_get_ns
+#elif LINUX_VERSION_CODE < KERNEL_VERSION (5, 3, 0)
+#define ktime_get_boottime_ns ktime_get_boot_ns
 #endif
 
 // WARNING: no overflow safety!
@@ -64,6 +64,7 @@
 #include "runtime/ksud.h"
 #include "sulog/event.h"
 #include "sulog/fd.h"
+#include "sulog/filter.h"
 
 #include "selinux/selinux.h"
 #include "selinux/sepolicy.h"
@@ -72,8 +73,9 @@
 #include "downstream/kprobes_common.h"
 #endif
 
-#ifdef CONFIG_KALLSYMS
 #include "external/chibihash64.h"
+
+#ifdef CONFIG_KALLSYMS
 #include "downstream/kallsyms_common.h"
 #endif
 
@@ -110,6 +112,7 @@
 
 #include "sulog/event.c"
 #include "sulog/fd.c"
+#include "sulog/filter.c"
 
 #include "hook/setuid_hook.c"
 
@@ -54,6 +54,8 @@ void on_post_fs_data(void)
 	ksu_load_allow_list();
 	// sanity check, this may influence the performance
 	stop_input_hook();
+	// modules get mounted from here on, retire the cached umount subsets
+	ksu_umount_list_changed();
 }
 
 extern void ext4_unregister_sysfs(struct super_block *sb);
@@ -83,6 +85,7 @@ void on_module_mounted(void)
 {
 	pr_info("on_module_mounted!\n");
 	ksu_module_mounted = true;
+	ksu_umount_list_changed();
 }
 
 void on_boot_completed(void)
@@ -90,6 +93,8 @@ void on_boot_completed(void)
 	ksu_boot_completed = true;
 	pr_info("on_boot_completed!\n");
 	track_throne(true);
+	// service scripts may have mounted more in the meantime
+	ksu_umount_list_changed();
 }
 
 static ssize_t (*orig_read)(struct file *, char __user *, size_t, loff_t *);
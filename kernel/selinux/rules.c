@@ -50,6 +50,98 @@ static inline const cpumask_t *ksu_get_current_cpumask_t() { return current->cpu
 static inline cpumask_t *ksu_get_current_cpumask_t() { return &current->cpus_allowed; }
 #endif
 
+// how long we held the live policy, every reader in the system waits on it
+static struct {
+	atomic64_t windows;
+	atomic64_t total_ns;
+	atomic64_t max_ns;
+} ksu_sepol_stall;
+
+static void ksu_sepol_stall_account(const char *what, u64 ns)
+{
+	u64 max = atomic64_read(&ksu_sepol_stall.max_ns);
+	u64 windows = atomic64_inc_return(&ksu_sepol_stall.windows);
+	u64 total = atomic64_add_return(ns, &ksu_sepol_stall.total_ns);
+
+	while (ns > max) {
+		u64 old = atomic64_cmpxchg(&ksu_sepol_stall.max_ns, max, ns);
+
+		if (old == max) {
+			max = ns;
+			break;
+		}
+		max = old;
+	}
+
+	pr_info("sepol: %s held the policy for %llu us (windows: %llu, max: %llu us, total: %llu us)\n", what,
+		ns / NSEC_PER_USEC, windows, max / NSEC_PER_USEC, total / NSEC_PER_USEC);
+}
+
+struct ksu_sepol_window {
+	int (*fn)(void *);
+	void *data;
+};
+
+// runs with the window held, so nothing else touches ksu_sepol_gfp
+static int ksu_sepol_window_fn(void *ptr)
+{
+	struct ksu_sepol_window *window = (struct ksu_sepol_window *)ptr;
+	int ret;
+
+	ksu_sepol_gfp = GFP_ATOMIC | __GFP_NOWARN;
+	ret = window->fn(window->data);
+	ksu_sepol_gfp = GFP_KERNEL;
+
+	return ret;
+}
+
+/*
+ * Run fn on the live policydb with every policy reader held off, under
+ * policy_rwlock when we can find it and stop_machine otherwise. Callers
+ * put everything they have into one call, each window stalls the system.
+ */
+static int ksu_sepol_live_window(int (*fn)(void *), void *data, const char *what)
+{
+	struct ksu_sepol_window window = { .fn = fn, .data = data };
+	rwlock_t *lock = ksu_get_policy_rwlock();
+	u64 start;
+	int ret;
+
+	if (!lock)
+		goto do_stop_machine;
+
+	/*
+	 * HACK: write_lock() is held with preempt enabled. DO NOT let the
+	 * task be migrated to any other CPU than the current CPU. And since
+	 * set_cpus_allowed_ptr() can sleep, use raw_smp_processor_id() to get
+	 * current CPU and bypass preemption checks.
+	 */
+	cpumask_t old_mask;
+	cpumask_copy(&old_mask, ksu_get_current_cpumask_t());
+	set_cpus_allowed_ptr(current, cpumask_of(raw_smp_processor_id()));
+
+	start = ktime_get_ns();
+	write_lock(lock);
+	preempt_enable();
+
+	ret = ksu_sepol_window_fn(&window);
+
+	preempt_disable();
+	write_unlock(lock);
+	ksu_sepol_stall_account(what, ktime_get_ns() - start);
+	set_cpus_allowed_ptr(current, &old_mask);
+	goto out;
+
+do_stop_machine:
+	start = ktime_get_ns();
+	ret = stop_machine(ksu_sepol_window_fn, &window, NULL);
+	ksu_sepol_stall_account(what, ktime_get_ns() - start);
+
+out:
+	smp_mb();
+	return ret;
+}
+
 #endif // < 5.10
 
 static int apply_kernelsu_rules_fn(void *ptr)
@@ -167,43 +259,17 @@ out_unlock:
 
 	db = get_policydb();
 
-	rwlock_t *lock = ksu_get_policy_rwlock();
-	if (!lock)
-		goto do_stop_machine;
-
-	/*
-	 * HACK: write_lock() is held with preempt enabled. DO NOT let the
-	 * task be migrated to any other CPU than the current CPU. And since
-	 * set_cpus_allowed_ptr() can sleep, use raw_smp_processor_id() to get
-	 * current CPU and bypass preemption checks.
-	 */
-	cpumask_t old_mask;
-	cpumask_copy(&old_mask, ksu_get_current_cpumask_t());
-	set_cpus_allowed_ptr(current, cpumask_of(raw_smp_processor_id()));
+	pr_info("%s: type: %s\n", __func__, ksu_get_policy_rwlock() ? "policy_rwlock" : "stop_machine()");
+	ksu_sepol_live_window(apply_kernelsu_rules_fn, (void *)db, "kernelsu rules");
 
-	pr_info("%s: type: policy_rwlock \n", __func__);
-	write_lock(lock);
-	preempt_enable();
-
-	apply_kernelsu_rules_fn((void *)db);
-
-	preempt_disable();
-	write_unlock(lock);
-	set_cpus_allowed_ptr(current, &old_mask);
-	goto out_flush;
-
-do_stop_machine:
-	pr_info("%s: type: stop_machine()\n", __func__);
-	stop_machine(apply_kernelsu_rules_fn, (void *)db, NULL);
-
-out_flush:
-	smp_mb();
 	reset_avc_cache();
 #endif
 }
 
 #define KSU_SEPOLICY_MAX_BATCH_SIZE (8U * 1024U * 1024U)
 #define KSU_SEPOLICY_MAX_ARGS 5
+// combinations one payload may expand its sets into
+#define KSU_SEPOLICY_MAX_EXPANDED (1U << 20)
 
 struct sepol_data {
 	u32 cmd;
@@ -467,16 +533,168 @@ static int apply_one_sepolicy_cmd(struct policydb *db, const struct sepol_data *
 	}
 }
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
-int handle_sepolicy(void __user *user_data, u64 data_len)
-{
-	struct selinux_policy *pol, *old_pol;
-	struct policydb *db;
-	struct sepol_batch_cursor cursor;
+/*
+ * A copied SET_SEPOLICY payload. The compact format gets its string table
+ * indexed here, in process context, since the apply side may run under
+ * stop_machine and cannot allocate.
+ */
+struct sepol_set {
+	u32 first; // into sepol_batch.members
+	u32 count;
+};
+
+struct sepol_batch {
 	u8 *payload;
+	size_t len;
+	bool compact;
+	u32 ref_size;
+	u32 nstrings;
+	const char **strings;
+	u32 nsets;
+	struct sepol_set *sets;
+	const char **members;
+	const u8 *records;
+	bool av_changed; // set by apply, some applied command can change a cached AVC decision
+	bool beyond_avtab; // set by apply, some command writes more than te_avtab
+	struct list_head list; // in a transaction queue, or the one batch of a SET_SEPOLICY
+};
+
+static u32 sepol_ref_at(const struct sepol_batch *batch, const u8 *p)
+{
+	if (batch->ref_size == sizeof(u16)) {
+		u16 ref;
+
+		memcpy(&ref, p, sizeof(ref));
+		return ref;
+	} else {
+		u32 ref;
+
+		memcpy(&ref, p, sizeof(ref));
+		return ref;
+	}
+}
+
+// resolve every set to its member strings up front, members are plain strings only
+static int sepol_batch_index_sets(struct sepol_batch *batch)
+{
+	struct ksu_sepolicy_compact_sets hdr;
+	const u8 *p, *end;
+	u32 i, filled = 0;
+
+	if ((size_t)(batch->payload + batch->len - batch->records) < sizeof(hdr))
+		return -EINVAL;
+	memcpy(&hdr, batch->records, sizeof(hdr));
+	p = batch->records + sizeof(hdr);
+
+	// every set takes at least its count and one member
+	if (!hdr.nsets || hdr.nrefs / 2 < hdr.nsets)
+		return -EINVAL;
+	if ((u64)hdr.nrefs * batch->ref_size > (u64)(batch->payload + batch->len - p))
+		return -EINVAL;
+	end = p + (size_t)hdr.nrefs * batch->ref_size;
+
+	batch->sets = kvmalloc(hdr.nsets * sizeof(*batch->sets), GFP_KERNEL);
+	batch->members = kvmalloc((hdr.nrefs - hdr.nsets) * sizeof(*batch->members), GFP_KERNEL);
+	if (!batch->sets || !batch->members)
+		return -ENOMEM;
+
+	for (i = 0; i < hdr.nsets; i++) {
+		u32 count, j;
+
+		if (p >= end)
+			return -EINVAL;
+		count = sepol_ref_at(batch, p);
+		p += batch->ref_size;
+		// members is sized for nrefs - nsets, the counts of later sets are not room for members
+		if (!count || count > hdr.nrefs - hdr.nsets - filled)
+			return -EINVAL;
+
+		batch->sets[i].first = filled;
+		batch->sets[i].count = count;
+		for (j = 0; j < count; j++) {
+			u32 ref = sepol_ref_at(batch, p);
+
+			if (!ref || ref > batch->nstrings)
+				return -EINVAL;
+			batch->members[filled++] = batch->strings[ref - 1];
+			p += batch->ref_size;
+		}
+	}
+	if (p != end)
+		return -EINVAL;
+
+	batch->nsets = hdr.nsets;
+	batch->records = end;
+	return 0;
+}
+
+static int sepol_batch_index_strings(struct sepol_batch *batch)
+{
+	struct ksu_sepolicy_compact_hdr hdr;
+	const char *str, *end;
+	u32 i;
+
+	if (batch->len < sizeof(hdr))
+		return -EINVAL;
+	memcpy(&hdr, batch->payload, sizeof(hdr));
+
+	if (hdr.flags & ~(KSU_SEPOLICY_COMPACT_REF16 | KSU_SEPOLICY_COMPACT_SETS))
+		return -EINVAL;
+	if (hdr.strings_len > batch->len - sizeof(hdr))
+		return -EINVAL;
+	// every string takes at least its terminator
+	if (hdr.nstrings > hdr.strings_len)
+		return -EINVAL;
+
+	batch->compact = true;
+	batch->ref_size = (hdr.flags & KSU_SEPOLICY_COMPACT_REF16) ? sizeof(u16) : sizeof(u32);
+	batch->nstrings = hdr.nstrings;
+	batch->records = batch->payload + sizeof(hdr) + hdr.strings_len;
+	if (!hdr.nstrings)
+		return (hdr.flags & KSU_SEPOLICY_COMPACT_SETS) ? -EINVAL : 0;
+
+	batch->strings = kvmalloc(hdr.nstrings * sizeof(*batch->strings), GFP_KERNEL);
+	if (!batch->strings)
+		return -ENOMEM;
+
+	str = (const char *)batch->payload + sizeof(hdr);
+	end = str + hdr.strings_len;
+	for (i = 0; i < hdr.nstrings; i++) {
+		const char *nul = memchr(str, '\0', end - str);
+
+		// empty strings would alias ALL
+		if (!nul || nul == str)
+			return -EINVAL;
+		batch->strings[i] = str;
+		str = nul + 1;
+	}
+	if (str != end)
+		return -EINVAL;
+
+	if (hdr.flags & KSU_SEPOLICY_COMPACT_SETS)
+		return sepol_batch_index_sets(batch);
+
+	return 0;
+}
+
+static void sepol_batch_release(struct sepol_batch *batch)
+{
+	kvfree(batch->members);
+	kvfree(batch->sets);
+	kvfree(batch->strings);
+	kvfree(batch->payload);
+	batch->members = NULL;
+	batch->sets = NULL;
+	batch->strings = NULL;
+	batch->payload = NULL;
+}
+
+static int sepol_batch_load(struct sepol_batch *batch, void __user *user_data, u64 data_len)
+{
+	u32 magic;
 	int ret;
-	int success_cmd_count;
-	u32 cmd_index;
+
+	memset(batch, 0, sizeof(*batch));
 
 	if (!user_data || !data_len) {
 		return -EINVAL;
@@ -486,37 +704,100 @@ int handle_sepolicy(void __user *user_data, u64 data_len)
 		return -E2BIG;
 	}
 
-	payload = kvmalloc((size_t)data_len, GFP_KERNEL);
-	if (!payload) {
+	batch->payload = kvmalloc((size_t)data_len, GFP_KERNEL);
+	if (!batch->payload) {
 		return -ENOMEM;
 	}
+	batch->len = (size_t)data_len;
 
-	if (copy_from_user(payload, user_data, (size_t)data_len)) {
+	if (copy_from_user(batch->payload, user_data, batch->len)) {
 		ret = -EFAULT;
-		goto out_free;
+		goto err;
 	}
 
-	if (!getenforce()) {
-		pr_info("SELinux permissive or disabled when handle policy!\n");
+	if (batch->len >= sizeof(magic)) {
+		memcpy(&magic, batch->payload, sizeof(magic));
+		if (magic == KSU_SEPOLICY_COMPACT_MAGIC) {
+			ret = sepol_batch_index_strings(batch);
+			if (ret < 0) {
+				pr_err("sepol: malformed compact payload header.\n");
+				goto err;
+			}
+		}
 	}
 
-	mutex_lock(&selinux_state.policy_mutex);
+	return 0;
 
-	old_pol = selinux_state.policy;
-	pol = ksu_dup_sepolicy(rcu_dereference_protected(old_pol, lockdep_is_held(&selinux_state.policy_mutex)));
-	if (IS_ERR(pol)) {
-		ret = PTR_ERR(pol);
-		pr_err("ksu_dup_sepolicy err: %d\n", ret);
-		goto out_unlock;
+err:
+	sepol_batch_release(batch);
+	return ret;
+}
+
+/*
+ * The AVC caches access decisions only. New attributes, type transitions
+ * and genfscon never change a decision it may hold, so a payload made of
+ * those alone does not need the cache flushed.
+ */
+static bool sepol_cmd_changes_av(u32 cmd)
+{
+	switch (cmd) {
+	case KSU_SEPOLICY_CMD_ATTR:
+	case KSU_SEPOLICY_CMD_TYPE_TRANSITION:
+	case KSU_SEPOLICY_CMD_TYPE_CHANGE:
+	case KSU_SEPOLICY_CMD_GENFSCON:
+		return false;
+	default:
+		return true;
 	}
-	db = &pol->policydb;
+}
 
-	cursor.cur = payload;
-	cursor.end = payload + (size_t)data_len;
+/*
+ * Commands that write te_avtab and nothing else, a payload made of these
+ * alone can go to a ksu_dup_sepolicy_avtab() copy. Named type transitions
+ * land in filename_trans instead.
+ */
+static bool sepol_cmd_avtab_only(u32 cmd, bool named)
+{
+	switch (cmd) {
+	case KSU_SEPOLICY_CMD_NORMAL_PERM:
+	case KSU_SEPOLICY_CMD_XPERM:
+	case KSU_SEPOLICY_CMD_TYPE_CHANGE:
+		return true;
+	case KSU_SEPOLICY_CMD_TYPE_TRANSITION:
+		return !named;
+	default:
+		return false;
+	}
+}
+
+static int sepol_apply_one(struct policydb *db, const struct sepol_data *header, const char **args, u32 cmd_index)
+{
+	int ret;
+
+	// dry run, the payload is only walked and counted
+	if (!db)
+		return 1;
+
+	ret = apply_one_sepolicy_cmd(db, header, args);
+	if (ret < 0) {
+		pr_err("sepol: cmd #%u failed, cmd=%u subcmd=%u.\n", cmd_index, header->cmd, header->subcmd);
+		return 0;
+	}
+
+	ksu_add_shit_to_list(header->cmd, args);
+	return 1;
+}
+
+static int sepol_apply_inline(struct policydb *db, struct sepol_batch *batch)
+{
+	struct sepol_batch_cursor cursor;
+	int success_cmd_count = 0;
+	u32 cmd_index = 0;
+	int ret;
+
+	cursor.cur = batch->payload;
+	cursor.end = batch->payload + batch->len;
 
-	ret = 0;
-	success_cmd_count = 0;
-	cmd_index = 0;
 	while (cursor.cur < cursor.end) {
 		struct sepol_data header;
 		const char *args[KSU_SEPOLICY_MAX_ARGS] = { 0 };
@@ -526,180 +807,507 @@ int handle_sepolicy(void __user *user_data, u64 data_len)
 		ret = sepol_read_cmd_header(&cursor, &header);
 		if (ret < 0) {
 			pr_err("sepol: failed to read cmd header #%u.\n", cmd_index);
-			goto out_drop_new_policy;
+			return ret;
 		}
 
 		expected_argc = sepol_expected_argc(header.cmd);
 		if (expected_argc < 0 || expected_argc > KSU_SEPOLICY_MAX_ARGS) {
-			ret = -EINVAL;
 			pr_err("sepol: invalid cmd header #%u.\n", cmd_index);
-			goto out_drop_new_policy;
+			return -EINVAL;
 		}
 
 		for (arg_index = 0; arg_index < (u32)expected_argc; arg_index++) {
 			ret = sepol_read_string(&cursor, &args[arg_index]);
 			if (ret < 0) {
 				pr_err("sepol: failed to read cmd #%u arg #%u.\n", cmd_index, arg_index);
-				goto out_drop_new_policy;
+				return ret;
 			}
 		}
 
-		ret = apply_one_sepolicy_cmd(db, &header, args);
-		if (ret < 0) {
-			pr_err("sepol: cmd #%u failed, cmd=%u subcmd=%u.\n", cmd_index, header.cmd, header.subcmd);
-		} else {
+		if (sepol_apply_one(db, &header, args, cmd_index)) {
 			success_cmd_count++;
-			ksu_add_shit_to_list(header.cmd, args);
+			batch->av_changed |= sepol_cmd_changes_av(header.cmd);
+			batch->beyond_avtab |= !sepol_cmd_avtab_only(header.cmd, args[4] != ALL);
 		}
 		cmd_index++;
 	}
 
-	rcu_assign_pointer(selinux_state.policy, pol);
-	synchronize_rcu();
-	ksu_destroy_sepolicy(old_pol);
+	return success_cmd_count;
+}
 
-	reset_avc_cache();
-	ret = success_cmd_count;
-	goto out_unlock;
+// a compact argument, one name (or ALL) or the members of a set
+struct sepol_arg {
+	const char *const *names;
+	u32 count;
+};
 
-out_drop_new_policy:
-	ksu_destroy_sepolicy(pol);
-out_unlock:
-	mutex_unlock(&selinux_state.policy_mutex);
-out_free:
-	kvfree(payload);
+static const char *const sepol_all = ALL;
 
-	return ret;
+static int sepol_read_ref(const struct sepol_batch *batch, struct sepol_batch_cursor *cursor, struct sepol_arg *out)
+{
+	u32 ref = sepol_ref_at(batch, cursor->cur);
+
+	cursor->cur += batch->ref_size;
+
+	if (ref == 0) {
+		out->names = &sepol_all;
+		out->count = 1;
+		return 0;
+	}
+	if (ref <= batch->nstrings) {
+		out->names = &batch->strings[ref - 1];
+		out->count = 1;
+		return 0;
+	}
+	ref -= batch->nstrings;
+	if (ref > batch->nsets) {
+		return -EINVAL;
+	}
+
+	out->names = &batch->members[batch->sets[ref - 1].first];
+	out->count = batch->sets[ref - 1].count;
+	return 0;
 }
-#else
 
-struct handle_sepolicy_args {
-	void *ctx_success_cmd_count;
-	void *ctx_payload;
-	u64 ctx_data_len;
-};
+// run a command once per combination of its arguments, last argument varies fastest
+static int sepol_apply_product(struct policydb *db, const struct sepol_data *header, const struct sepol_arg *argv,
+			       int argc, u32 *cmd_index)
+{
+	const char *args[KSU_SEPOLICY_MAX_ARGS] = { 0 };
+	u32 pos[KSU_SEPOLICY_MAX_ARGS] = { 0 };
+	int success_cmd_count = 0;
+	int i;
 
-static int handle_sepolicy_fn(void *data)
+	for (;;) {
+		for (i = 0; i < argc; i++)
+			args[i] = argv[i].names[pos[i]];
+
+		success_cmd_count += sepol_apply_one(db, header, args, *cmd_index);
+		(*cmd_index)++;
+
+		for (i = argc - 1; i >= 0; i--) {
+			if (++pos[i] < argv[i].count)
+				break;
+			pos[i] = 0;
+		}
+		if (i < 0)
+			break;
+	}
+
+	return success_cmd_count;
+}
+
+static int sepol_apply_compact(struct policydb *db, struct sepol_batch *batch)
 {
 	struct sepol_batch_cursor cursor;
-	int ret = 0;
-	u32 cmd_index = 0;
 	int success_cmd_count = 0;
+	u32 cmd_index = 0;
+	u32 group_index = 0;
+	u64 expanded = 0;
+	int ret;
 
-	struct policydb *db = get_policydb();
-	struct handle_sepolicy_args *ctx = (struct handle_sepolicy_args *)data;
-	u8 *payload = (u8 *)ctx->ctx_payload;
-	u64 data_len = ctx->ctx_data_len;
-
-	cursor.cur = payload;
-	cursor.end = payload + (size_t)data_len;
+	cursor.cur = batch->records;
+	cursor.end = batch->payload + batch->len;
 
 	while (cursor.cur < cursor.end) {
+		struct ksu_sepolicy_compact_group group;
 		struct sepol_data header;
-		const char *args[KSU_SEPOLICY_MAX_ARGS] = { 0 };
 		int expected_argc;
-		u32 arg_index;
+		u32 i;
 
-		ret = sepol_read_cmd_header(&cursor, &header);
-		if (ret < 0) {
-			pr_err("sepol: failed to read cmd header #%u.\n", cmd_index);
-			goto out;
+		if (sepol_remaining(&cursor) < sizeof(group)) {
+			pr_err("sepol: failed to read group #%u.\n", group_index);
+			return -EINVAL;
 		}
+		memcpy(&group, cursor.cur, sizeof(group));
+		cursor.cur += sizeof(group);
 
-		expected_argc = sepol_expected_argc(header.cmd);
+		expected_argc = sepol_expected_argc(group.cmd);
 		if (expected_argc < 0 || expected_argc > KSU_SEPOLICY_MAX_ARGS) {
-			ret = -EINVAL;
-			pr_err("sepol: invalid cmd header #%u.\n", cmd_index);
-			goto out;
+			pr_err("sepol: invalid group #%u.\n", group_index);
+			return -EINVAL;
+		}
+		// check the whole group up front, refs are fixed size
+		if ((u64)group.count * expected_argc * batch->ref_size > sepol_remaining(&cursor)) {
+			pr_err("sepol: group #%u is truncated.\n", group_index);
+			return -EINVAL;
 		}
 
-		for (arg_index = 0; arg_index < (u32)expected_argc; arg_index++) {
-			ret = sepol_read_string(&cursor, &args[arg_index]);
-			if (ret < 0) {
-				pr_err("sepol: failed to read cmd #%u arg #%u.\n", cmd_index, arg_index);
-				goto out;
+		header.cmd = group.cmd;
+		header.subcmd = group.subcmd;
+		for (i = 0; i < group.count; i++) {
+			struct sepol_arg argv[KSU_SEPOLICY_MAX_ARGS];
+			u64 combinations = 1;
+			u32 arg_index;
+			int applied;
+
+			for (arg_index = 0; arg_index < (u32)expected_argc; arg_index++) {
+				ret = sepol_read_ref(batch, &cursor, &argv[arg_index]);
+				if (ret < 0) {
+					pr_err("sepol: bad string ref in cmd #%u arg #%u.\n", cmd_index, arg_index);
+					return ret;
+				}
+				// sets are bounded by the payload, their product is not
+				combinations *= argv[arg_index].count;
+				if (expanded + combinations > KSU_SEPOLICY_MAX_EXPANDED) {
+					pr_err("sepol: payload expands past %u commands.\n", KSU_SEPOLICY_MAX_EXPANDED);
+					return -E2BIG;
+				}
+			}
+			expanded += combinations;
+
+			applied = sepol_apply_product(db, &header, argv, expected_argc, &cmd_index);
+			if (applied) {
+				success_cmd_count += applied;
+				batch->av_changed |= sepol_cmd_changes_av(header.cmd);
+				batch->beyond_avtab |=
+					!sepol_cmd_avtab_only(header.cmd, expected_argc > 4 && argv[4].names != &sepol_all);
 			}
 		}
+		group_index++;
+	}
 
-		ret = apply_one_sepolicy_cmd(db, &header, args);
-		if (ret < 0)
-			pr_err("sepol: cmd #%u failed, cmd=%u subcmd=%u.\n", cmd_index, header.cmd, header.subcmd);
-		else {
-			pr_info("sepol: cmd #%u success, cmd=%u subcmd=%u.\n", cmd_index, header.cmd, header.subcmd);
-			success_cmd_count++;
-			ksu_add_shit_to_list(header.cmd, args);
-		}
+	return success_cmd_count;
+}
 
-		cmd_index++;
+/*
+ * returns how many commands applied, or a negative error for a malformed
+ * payload. A NULL db only checks the payload and counts its commands.
+ */
+static int sepol_apply_payload(struct policydb *db, struct sepol_batch *batch)
+{
+	if (batch->compact)
+		return sepol_apply_compact(db, batch);
+
+	return sepol_apply_inline(db, batch);
+}
+
+/*
+ * One sepolicy transaction at a time, owned by the thread group that
+ * opened it. Module rules at boot go through a single transaction instead
+ * of one SET_SEPOLICY (a policy copy or stall, swap and AVC reset) per
+ * file: APPEND checks and queues a payload, COMMIT applies the queue in
+ * one go and ABORT drops it untouched.
+ */
+struct ksu_sepol_txn {
+	struct pid *owner;
+	struct list_head queued; // checked sepol_batch payloads waiting for COMMIT
+	size_t queued_bytes;
+};
+
+// queued APPENDs must not pin more than this much kernel memory
+#define KSU_SEPOLICY_MAX_QUEUED (4U * KSU_SEPOLICY_MAX_BATCH_SIZE)
+
+static DEFINE_MUTEX(ksu_sepol_txn_mutex);
+static struct ksu_sepol_txn *ksu_sepol_txn;
+
+static bool ksu_sepol_txn_owned(const struct ksu_sepol_txn *txn)
+{
+	return txn->owner == task_tgid(current);
+}
+
+static bool ksu_sepol_txn_orphaned(const struct ksu_sepol_txn *txn)
+{
+	struct task_struct *task = get_pid_task(txn->owner, PIDTYPE_PID);
+
+	if (!task)
+		return true;
+	put_task_struct(task);
+	return false;
+}
+
+static void ksu_sepol_txn_free(struct ksu_sepol_txn *txn)
+{
+	struct sepol_batch *batch, *tmp;
+
+	list_for_each_entry_safe (batch, tmp, &txn->queued, list) {
+		list_del(&batch->list);
+		sepol_batch_release(batch);
+		kfree(batch);
 	}
+	put_pid(txn->owner);
+	kfree(txn);
+}
 
-out:
-	*(int *)(ctx->ctx_success_cmd_count) = success_cmd_count;
+// walk a payload without applying it, malformed ones fail here before any policy is touched
+static int sepol_batch_check(struct sepol_batch *batch)
+{
+	int ret = sepol_apply_payload(NULL, batch);
+
+	batch->av_changed = false;
 	return ret;
 }
 
-int handle_sepolicy(void __user *user_data, u64 data_len)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0)
+/*
+ * Apply checked batches to a copy of the policy and swap it in, returns
+ * how many commands applied. Batches of plain avtab rules get a copy that
+ * only clones te_avtab and shares the rest with the live policy.
+ */
+static int sepol_apply_batches(struct list_head *batches, const char *what)
 {
-	u8 *payload;
-	int ret = 0;
+	struct selinux_policy *pol, *old_pol;
+	struct sepol_batch *batch;
+	bool avtab_only = true;
+	bool av_changed = false;
 	int success_cmd_count = 0;
+	u64 start;
+	int ret;
 
-	if (!user_data || !data_len)
-    		return -EINVAL;
+	list_for_each_entry (batch, batches, list)
+		avtab_only &= !batch->beyond_avtab;
 
-	if (data_len > KSU_SEPOLICY_MAX_BATCH_SIZE)
-		return -E2BIG;
+	mutex_lock(&selinux_state.policy_mutex);
 
-	payload = kvmalloc((size_t)data_len, GFP_KERNEL);
-	if (!payload)
-		return -ENOMEM;
+	old_pol = rcu_dereference_protected(selinux_state.policy, lockdep_is_held(&selinux_state.policy_mutex));
+	start = ktime_get_ns();
+	pol = avtab_only ? ksu_dup_sepolicy_avtab(old_pol) : ksu_dup_sepolicy(old_pol);
+	if (IS_ERR(pol)) {
+		ret = PTR_ERR(pol);
+		pr_err("ksu_dup_sepolicy err: %d\n", ret);
+		goto out_unlock;
+	}
+	pr_info("sepol: %s copied the policy (%s) in %llu us\n", what, avtab_only ? "avtab only" : "full",
+		(ktime_get_ns() - start) / NSEC_PER_USEC);
 
-	if (copy_from_user(payload, user_data, (size_t)data_len)) {
-		ret = -EFAULT;
-		goto out_free;
+	list_for_each_entry (batch, batches, list) {
+		ret = sepol_apply_payload(&pol->policydb, batch);
+		if (ret < 0)
+			goto out_drop_new_policy;
+		success_cmd_count += ret;
+		av_changed |= batch->av_changed;
+	}
+
+	// a batch that changed nothing leaves the policy alone
+	ret = 0;
+	if (!success_cmd_count)
+		goto out_drop_new_policy;
+
+	rcu_assign_pointer(selinux_state.policy, pol);
+	synchronize_rcu();
+	// the new policy owns whatever the two shared now
+	if (avtab_only)
+		ksu_release_sepolicy_avtab(old_pol);
+	else
+		ksu_destroy_sepolicy(old_pol);
+
+	if (av_changed)
+		reset_avc_cache();
+	ret = success_cmd_count;
+	goto out_unlock;
+
+out_drop_new_policy:
+	if (avtab_only)
+		ksu_release_sepolicy_avtab(pol);
+	else
+		ksu_destroy_sepolicy(pol);
+out_unlock:
+	mutex_unlock(&selinux_state.policy_mutex);
+
+	return ret;
+}
+#else
+
+struct handle_sepolicy_args {
+	struct list_head *batches;
+	int success_cmd_count;
+};
+
+static int handle_sepolicy_fn(void *data)
+{
+	struct handle_sepolicy_args *ctx = (struct handle_sepolicy_args *)data;
+	struct sepol_batch *batch;
+	int ret = 0;
+
+	list_for_each_entry (batch, ctx->batches, list) {
+		int applied = sepol_apply_payload(get_policydb(), batch);
+
+		// keep going, what the other batches hold is independent of this one
+		if (applied < 0) {
+			if (!ret)
+				ret = applied;
+			continue;
+		}
+		ctx->success_cmd_count += applied;
 	}
 
+	return ret;
+}
+
+/*
+ * Apply checked batches straight to the live policy in one window,
+ * returns how many commands applied. Every window stalls the system, so
+ * callers hand in everything they have at once.
+ *
+ * A failed batch does not undo the others, they are live already. Like
+ * SET_SEPOLICY, that is reported as a short count rather than an error,
+ * so nobody applies the queue a second time.
+ */
+static int sepol_apply_batches(struct list_head *batches, const char *what)
+{
+	struct handle_sepolicy_args ctx = {
+		.batches = batches,
+	};
+	struct sepol_batch *batch;
+	bool av_changed = false;
+	int ret;
+
+	ret = ksu_sepol_live_window(handle_sepolicy_fn, (void *)&ctx, what);
+
+	list_for_each_entry (batch, batches, list)
+		av_changed |= batch->av_changed;
+	// rules before a failed command are live already
+	if (av_changed)
+		reset_avc_cache();
+
+	if (ret && !ctx.success_cmd_count)
+		return ret;
+	if (ret)
+		pr_err("sepol: %s partially applied (%d commands): %d\n", what, ctx.success_cmd_count, ret);
+
+	return ctx.success_cmd_count;
+}
+#endif
+
+int handle_sepolicy(void __user *user_data, u64 data_len)
+{
+	struct sepol_batch batch;
+	LIST_HEAD(batches);
+	int ret;
+
+	ret = sepol_batch_load(&batch, user_data, data_len);
+	if (ret < 0)
+		return ret;
+
 	if (!getenforce()) {
 		pr_info("SELinux permissive or disabled when handle policy!\n");
 	}
 
-	struct handle_sepolicy_args ctx = { 0 };
-	ctx.ctx_success_cmd_count = (void *)&success_cmd_count;
-	ctx.ctx_payload = (void *)payload;
-	ctx.ctx_data_len = (u64)data_len;
+	ret = sepol_batch_check(&batch);
+	if (ret > 0) {
+		list_add(&batch.list, &batches);
+		ret = sepol_apply_batches(&batches, "sepolicy");
+	}
 
-	rwlock_t *lock = ksu_get_policy_rwlock();
-	if (!lock)
-		goto do_stop_machine;
+	sepol_batch_release(&batch);
 
-	cpumask_t old_mask;
-	cpumask_copy(&old_mask, ksu_get_current_cpumask_t());
-	set_cpus_allowed_ptr(current, cpumask_of(raw_smp_processor_id()));
+	return ret;
+}
 
-	write_lock(lock);
-	preempt_enable();
+static int ksu_sepol_txn_begin(void)
+{
+	struct ksu_sepol_txn *txn;
+
+	if (ksu_sepol_txn) {
+		if (!ksu_sepol_txn_orphaned(ksu_sepol_txn))
+			return -EBUSY;
+		pr_info("sepol: dropping transaction of a dead owner\n");
+		ksu_sepol_txn_free(ksu_sepol_txn);
+		ksu_sepol_txn = NULL;
+	}
 
-	ret = handle_sepolicy_fn((void *)&ctx);
+	txn = kzalloc(sizeof(*txn), GFP_KERNEL);
+	if (!txn)
+		return -ENOMEM;
 
-	preempt_disable();
-	write_unlock(lock);
-	set_cpus_allowed_ptr(current, &old_mask);
-	goto out_done;
+	txn->owner = get_pid(task_tgid(current));
+	INIT_LIST_HEAD(&txn->queued);
 
-do_stop_machine:
-	ret = stop_machine(handle_sepolicy_fn, (void *)&ctx, NULL);
+	ksu_sepol_txn = txn;
+	return 0;
+}
 
-out_done:
-	if (ret)
-		goto out_free;
+// returns how many commands the payload holds once queued
+static int ksu_sepol_txn_append(void __user *user_data, u64 data_len)
+{
+	struct sepol_batch *batch;
+	int ret;
 
-	smp_mb();
-	reset_avc_cache();
-	ret = success_cmd_count;
+	batch = kmalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return -ENOMEM;
+
+	ret = sepol_batch_load(batch, user_data, data_len);
+	if (ret < 0) {
+		kfree(batch);
+		return ret;
+	}
+
+	if (ksu_sepol_txn->queued_bytes + batch->len > KSU_SEPOLICY_MAX_QUEUED) {
+		ret = -E2BIG;
+		goto out_drop;
+	}
+
+	ret = sepol_batch_check(batch);
+	if (ret <= 0)
+		goto out_drop;
+
+	ksu_sepol_txn->queued_bytes += batch->len;
+	list_add_tail(&batch->list, &ksu_sepol_txn->queued);
+	return ret;
+
+out_drop:
+	sepol_batch_release(batch);
+	kfree(batch);
+	return ret;
+}
+
+int handle_sepolicy_txn(u32 op, void __user *user_data, u64 data_len)
+{
+	struct ksu_sepol_txn *txn;
+	int ret;
 
-out_free:
-	kvfree(payload);
+	mutex_lock(&ksu_sepol_txn_mutex);
+
+	if (op == KSU_SEPOLICY_TXN_BEGIN) {
+		ret = ksu_sepol_txn_begin();
+		goto out_unlock;
+	}
+
+	txn = ksu_sepol_txn;
+	if (!txn || !ksu_sepol_txn_owned(txn)) {
+		ret = -ENOENT;
+		goto out_unlock;
+	}
 
+	switch (op) {
+	case KSU_SEPOLICY_TXN_APPEND:
+		ret = ksu_sepol_txn_append(user_data, data_len);
+		break;
+	case KSU_SEPOLICY_TXN_COMMIT:
+		ret = list_empty(&txn->queued) ? 0 : sepol_apply_batches(&txn->queued, "transaction");
+		ksu_sepol_txn = NULL;
+		ksu_sepol_txn_free(txn);
+		break;
+	case KSU_SEPOLICY_TXN_ABORT:
+		ksu_sepol_txn = NULL;
+		ksu_sepol_txn_free(txn);
+		ret = 0;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+out_unlock:
+	mutex_unlock(&ksu_sepol_txn_mutex);
 	return ret;
 }
-#endif
+
+// driver fd went away, drop a transaction its process left open
+void ksu_sepolicy_txn_release(void)
+{
+	struct ksu_sepol_txn *txn = NULL;
+
+	mutex_lock(&ksu_sepol_txn_mutex);
+	if (ksu_sepol_txn && ksu_sepol_txn_owned(ksu_sepol_txn)) {
+		txn = ksu_sepol_txn;
+		ksu_sepol_txn = NULL;
+	}
+	mutex_unlock(&ksu_sepol_txn_mutex);
+
+	if (txn) {
+		pr_info("sepol: aborting unfinished transaction\n");
+		ksu_sepol_txn_free(txn);
+	}
+}
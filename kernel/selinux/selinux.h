@@ -33,6 +33,10 @@ void apply_kernelsu_rules();
 
 int handle_sepolicy(void __user *user_data, u64 data_len);
 
+int handle_sepolicy_txn(u32 op, void __user *user_data, u64 data_len);
+
+void ksu_sepolicy_txn_release(void);
+
 void setup_ksu_cred();
 
 void escape_to_root_for_adb_root();
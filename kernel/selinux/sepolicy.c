@@ -178,48 +178,110 @@ static inline void avtab_set_slot(struct avtab *ab, int i, struct avtab_node *no
 }
 #endif
 
-static bool remove_avtab_node(struct policydb *db, struct avtab_node *node)
+/*
+ * Copy of avtab_hash() from ss/avtab.c, which is static. Kernels before
+ * 4.3 and vendor trees may hash differently, so a miss in the guessed
+ * bucket still falls back to scanning every slot.
+ */
+static u32 ksu_avtab_hash(const struct avtab_key *keyp, u32 mask)
+{
+	static const u32 c1 = 0xcc9e2d51;
+	static const u32 c2 = 0x1b873593;
+	static const u32 r1 = 15;
+	static const u32 r2 = 13;
+	static const u32 m = 5;
+	static const u32 n = 0xe6546b64;
+	u32 hash = 0;
+
+#define mix(input)                                                             \
+	do {                                                                   \
+		u32 v = input;                                                 \
+		v *= c1;                                                       \
+		v = (v << r1) | (v >> (32 - r1));                              \
+		v *= c2;                                                       \
+		hash ^= v;                                                     \
+		hash = (hash << r2) | (hash >> (32 - r2));                     \
+		hash = hash * m + n;                                           \
+	} while (0)
+
+	mix(keyp->target_class);
+	mix(keyp->target_type);
+	mix(keyp->source_type);
+
+#undef mix
+
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash & mask;
+}
+
+static bool unlink_avtab_node_in_slot(struct avtab *tab, int slot, struct avtab_node *node)
 {
+	struct avtab_node *n;
+	struct avtab_node *prev = NULL;
+
+	for (n = avtab_get_slot(tab, slot); n; prev = n, n = n->next) {
+		if (n != node)
+			continue;
+
+		if (prev)
+			prev->next = n->next;
+		else
+			avtab_set_slot(tab, slot, n->next);
+		return true;
+	}
+
+	return false;
+}
+
+static bool unlink_avtab_node(struct avtab *tab, struct avtab_node *node)
+{
+	int guess = ksu_avtab_hash(&node->key, tab->mask);
 	int i;
+
+	if (guess < tab->nslot && unlink_avtab_node_in_slot(tab, guess, node))
+		return true;
+
+	for (i = 0; i < tab->nslot; i++) {
+		if (i != guess && unlink_avtab_node_in_slot(tab, i, node))
+			return true;
+	}
+
+	return false;
+}
+
+static bool remove_avtab_node(struct policydb *db, struct avtab_node *node)
+{
 	int ret;
 	int shrink_size = sizeof(struct avtab_key) + sizeof(struct avtab_datum);
 	struct avtab removed = {};
-	struct avtab_node *n;
-	struct avtab_node *prev;
 
 	ret = avtab_alloc(&removed, 1);
 	if (ret < 0)
 		return false;
 
-	for (i = 0; i < db->te_avtab.nslot; i++) {
-		prev = NULL;
-		for (n = avtab_get_slot(&db->te_avtab, i); n; prev = n, n = n->next) {
-			if (n != node)
-				continue;
-
-			if (prev)
-				prev->next = n->next;
-			else
-				avtab_set_slot(&db->te_avtab, i, n->next);
+	if (!db->te_avtab.nslot || !unlink_avtab_node(&db->te_avtab, node)) {
+		avtab_destroy(&removed);
+		return false;
+	}
 
-			if (db->te_avtab.nel > 0)
-				db->te_avtab.nel--;
+	if (db->te_avtab.nel > 0)
+		db->te_avtab.nel--;
 
-			if ((n->key.specified & AVTAB_XPERMS) && n->datum.u.xperms) {
-				shrink_size += sizeof(u8) + sizeof(u8) + sizeof(u32) * ARRAY_SIZE(n->datum.u.xperms->perms.p);
-			}
-			n->next = NULL;
-			avtab_set_slot(&removed, 0, n);
-			removed.nel = 1;
-			avtab_destroy(&removed);
-			if (db->len >= shrink_size)
-				db->len -= shrink_size;
-			return true;
-		}
+	if ((node->key.specified & AVTAB_XPERMS) && node->datum.u.xperms) {
+		shrink_size += sizeof(u8) + sizeof(u8) + sizeof(u32) * ARRAY_SIZE(node->datum.u.xperms->perms.p);
 	}
-
+	node->next = NULL;
+	avtab_set_slot(&removed, 0, node);
+	removed.nel = 1;
 	avtab_destroy(&removed);
-	return false;
+	if (db->len >= shrink_size)
+		db->len -= shrink_size;
+	return true;
 }
 
 static bool add_rule(struct policydb *db, const char *s, const char *t, const char *c, const char *p, int effect,
@@ -272,83 +334,184 @@ static bool add_rule(struct policydb *db, const char *s, const char *t, const ch
 	return add_rule_raw(db, src, tgt, cls, perm, effect, invert);
 }
 
-static bool add_rule_raw(struct policydb *db, struct type_datum *src, struct type_datum *tgt, struct class_datum *cls,
-						 struct perm_datum *perm, int effect, bool invert)
+static bool add_rule_leaf(struct policydb *db, struct type_datum *src, struct type_datum *tgt, struct class_datum *cls,
+			  struct perm_datum *perm, int effect, bool invert)
 {
+	struct avtab_key key;
+	struct avtab_node *node;
+
+	key.source_type = src->value;
+	key.target_type = tgt->value;
+	key.target_class = cls->value;
+	key.specified = effect;
+
+	if (invert && effect != AVTAB_AUDITDENY) {
+		node = avtab_search_node(&db->te_avtab, &key);
+		if (!node)
+			return true;
+	} else {
+		node = get_avtab_node(db, &key, NULL);
+		if (!node)
+			return false;
+	}
+
+	if (invert) {
+		if (perm)
+			node->datum.u.data &= ~(1U << (perm->value - 1));
+		else
+			node->datum.u.data = 0U;
+	} else {
+		if (perm)
+			node->datum.u.data |= 1U << (perm->value - 1);
+		else
+			node->datum.u.data = ~0U;
+	}
+	if (is_redundant_avtab_node(node))
+		return remove_avtab_node(db, node);
+
+	return true;
+}
+
+static inline bool wildcard_type_skipped(struct type_datum *type, bool attr_only)
+{
+	// aliases share the value of their primary type
+	return !type->primary || (attr_only && !type->attribute);
+}
+
+/*
+ * Flags for scratch allocations while editing a policydb. 5.10+ edits a
+ * private copy under policy_mutex and may sleep; ksu_sepol_live_window()
+ * switches to atomic while it holds every policy reader off.
+ */
+static gfp_t ksu_sepol_gfp = GFP_KERNEL;
+
+/*
+ * add_rule_raw() walks the symbol tables instead when these fail, which
+ * atomic allocations of a whole type table may well do.
+ */
+static struct type_datum **collect_wildcard_types(struct policydb *db, bool attr_only, u32 *count)
+{
+	struct type_datum **types;
+	struct hashtab_node *node;
+	u32 cap = db->p_types.nprim;
+	u32 n = 0;
+
+	types = kmalloc_array(cap ? cap : 1, sizeof(*types), ksu_sepol_gfp);
+	if (!types)
+		return NULL;
+
+	ksu_hashtab_for_each(db->p_types.table, node)
+	{
+		struct type_datum *type = (struct type_datum *)node->datum;
+
+		if (wildcard_type_skipped(type, attr_only))
+			continue;
+		if (n < cap)
+			types[n++] = type;
+	}
+
+	*count = n;
+	return types;
+}
+
+static struct class_datum **collect_wildcard_classes(struct policydb *db, u32 *count)
+{
+	struct class_datum **classes;
+	struct hashtab_node *node;
+	u32 cap = db->p_classes.nprim;
+	u32 n = 0;
+
+	classes = kmalloc_array(cap ? cap : 1, sizeof(*classes), ksu_sepol_gfp);
+	if (!classes)
+		return NULL;
+
+	ksu_hashtab_for_each(db->p_classes.table, node)
+	{
+		if (n < cap)
+			classes[n++] = (struct class_datum *)node->datum;
+	}
+
+	*count = n;
+	return classes;
+}
+
+// fills in one wildcard per level, for when the flat lists can't be allocated
+static bool add_rule_walk(struct policydb *db, struct type_datum *src, struct type_datum *tgt, struct class_datum *cls,
+			  struct perm_datum *perm, int effect, bool invert)
+{
+	struct hashtab_node *node;
+	bool attr_only = !strip_av(effect, invert);
 	bool success = true;
 
-	if (src == NULL) {
-		struct hashtab_node *node;
-		if (strip_av(effect, invert)) {
-			ksu_hashtab_for_each(db->p_types.table, node)
-			{
-				success &= add_rule_raw(db, (struct type_datum *)node->datum, tgt, cls, perm, effect, invert);
-			};
-		} else {
-			ksu_hashtab_for_each(db->p_types.table, node)
-			{
-				struct type_datum *type = (struct type_datum *)(node->datum);
-				if (type->attribute) {
-					success &= add_rule_raw(db, type, tgt, cls, perm, effect, invert);
-				}
-			};
-		}
-	} else if (tgt == NULL) {
-		struct hashtab_node *node;
-		if (strip_av(effect, invert)) {
-			ksu_hashtab_for_each(db->p_types.table, node)
-			{
-				success &= add_rule_raw(db, src, (struct type_datum *)node->datum, cls, perm, effect, invert);
-			};
-		} else {
-			ksu_hashtab_for_each(db->p_types.table, node)
-			{
-				struct type_datum *type = (struct type_datum *)(node->datum);
-				if (type->attribute) {
-					success &= add_rule_raw(db, src, type, cls, perm, effect, invert);
-				}
-			};
-		}
-	} else if (cls == NULL) {
-		struct hashtab_node *node;
+	if (src == NULL || tgt == NULL) {
+		ksu_hashtab_for_each(db->p_types.table, node)
+		{
+			struct type_datum *type = (struct type_datum *)node->datum;
+
+			if (wildcard_type_skipped(type, attr_only))
+				continue;
+			if (src == NULL)
+				success &= add_rule_raw(db, type, tgt, cls, perm, effect, invert);
+			else
+				success &= add_rule_raw(db, src, type, cls, perm, effect, invert);
+		};
+	} else {
 		ksu_hashtab_for_each(db->p_classes.table, node)
 		{
 			success &= add_rule_raw(db, src, tgt, (struct class_datum *)node->datum, perm, effect, invert);
-		}
-	} else {
-		struct avtab_key key;
-		struct avtab_node *node;
+		};
+	}
 
-		key.source_type = src->value;
-		key.target_type = tgt->value;
-		key.target_class = cls->value;
-		key.specified = effect;
+	return success;
+}
 
-		if (invert && effect != AVTAB_AUDITDENY) {
-			node = avtab_search_node(&db->te_avtab, &key);
-			if (!node)
-				return true;
-		} else {
-			node = get_avtab_node(db, &key, NULL);
-			if (!node)
-				return false;
+/*
+ * A NULL src, tgt or cls is a wildcard. Wildcards are expanded once into
+ * flat lists and the leaves walked in one loop nest, instead of recursing
+ * and rescanning the symbol tables for every combination.
+ */
+static bool add_rule_raw(struct policydb *db, struct type_datum *src, struct type_datum *tgt, struct class_datum *cls,
+						 struct perm_datum *perm, int effect, bool invert)
+{
+	struct type_datum **srcs = &src, **tgts = &tgt, **wild_types = NULL;
+	struct class_datum **clss = &cls, **wild_classes = NULL;
+	u32 nsrc = 1, ntgt = 1, ncls = 1, nwild = 0;
+	u32 i, j, k;
+	bool success = true;
+
+	if (!src || !tgt) {
+		// adding rules to every type is pointless, attributes cover them
+		wild_types = collect_wildcard_types(db, !strip_av(effect, invert), &nwild);
+		if (!wild_types)
+			return add_rule_walk(db, src, tgt, cls, perm, effect, invert);
+		if (!src) {
+			srcs = wild_types;
+			nsrc = nwild;
+		}
+		if (!tgt) {
+			tgts = wild_types;
+			ntgt = nwild;
 		}
+	}
 
-		if (invert) {
-			if (perm)
-				node->datum.u.data &= ~(1U << (perm->value - 1));
-			else
-				node->datum.u.data = 0U;
-		} else {
-			if (perm)
-				node->datum.u.data |= 1U << (perm->value - 1);
-			else
-				node->datum.u.data = ~0U;
+	if (!cls) {
+		wild_classes = collect_wildcard_classes(db, &ncls);
+		if (!wild_classes) {
+			kfree(wild_types);
+			return add_rule_walk(db, src, tgt, cls, perm, effect, invert);
+		}
+		clss = wild_classes;
+	}
+
+	for (i = 0; i < nsrc; i++) {
+		for (j = 0; j < ntgt; j++) {
+			for (k = 0; k < ncls; k++)
+				success &= add_rule_leaf(db, srcs[i], tgts[j], clss[k], perm, effect, invert);
 		}
-		if (is_redundant_avtab_node(node))
-			return remove_avtab_node(db, node);
 	}
 
+	kfree(wild_classes);
+	kfree(wild_types);
 	return success;
 }
 
@@ -1233,6 +1396,58 @@ void ksu_destroy_sepolicy(struct selinux_policy *pol)
 	kfree(pol);
 }
 
+/*
+ * Copy of old_pol that owns a clone of te_avtab and shares every other
+ * part of the policydb with it, the way security_set_bools() shares all
+ * but the conditional tables. Good for batches that only add avtab rules,
+ * which is what module rules mostly are, and much cheaper than the
+ * policydb_write()/policydb_read() round trip of ksu_dup_sepolicy().
+ *
+ * policy_mutex has to be held from here until one of the two is swapped
+ * in or dropped. The one that is not kept goes away with
+ * ksu_release_sepolicy_avtab(), the other one then owns the shared parts.
+ */
+struct selinux_policy *ksu_dup_sepolicy_avtab(struct selinux_policy *old_pol)
+{
+	struct avtab *old_tab = &old_pol->policydb.te_avtab;
+	struct selinux_policy *new_pol;
+	struct avtab_node *cur;
+	int ret;
+
+	new_pol = kmemdup(old_pol, sizeof(*old_pol), GFP_KERNEL);
+	if (!new_pol)
+		return ERR_PTR(-ENOMEM);
+
+	avtab_init(&new_pol->policydb.te_avtab);
+	// at least one slot, rules are inserted into it afterwards
+	ret = avtab_alloc(&new_pol->policydb.te_avtab, max_t(u32, old_tab->nel, 1));
+	if (ret)
+		goto out_free_pol;
+
+	// insert_nonunique keeps duplicate xperms nodes and copies their xperms
+	avtab_for_each((*old_tab), cur) {
+		if (!avtab_insert_nonunique(&new_pol->policydb.te_avtab, &cur->key, &cur->datum)) {
+			ret = -ENOMEM;
+			goto out_destroy_avtab;
+		}
+	}
+
+	return new_pol;
+
+out_destroy_avtab:
+	avtab_destroy(&new_pol->policydb.te_avtab);
+out_free_pol:
+	kfree(new_pol);
+	pr_err("sepolicy: dup avtab: %d\n", ret);
+	return ERR_PTR(ret);
+}
+
+void ksu_release_sepolicy_avtab(struct selinux_policy *pol)
+{
+	avtab_destroy(&pol->policydb.te_avtab);
+	kfree(pol);
+}
+
 struct selinux_policy *ksu_dup_sepolicy(struct selinux_policy *old_pol)
 {
 	int ret;
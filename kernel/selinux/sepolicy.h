@@ -7,6 +7,10 @@
 struct selinux_policy *ksu_dup_sepolicy(struct selinux_policy *old_pol);
 
 void ksu_destroy_sepolicy(struct selinux_policy *orig);
+
+// Copy that only clones te_avtab, see sepolicy.c before using it
+struct selinux_policy *ksu_dup_sepolicy_avtab(struct selinux_policy *old_pol);
+void ksu_release_sepolicy_avtab(struct selinux_policy *pol);
 #endif
 
 // Operation on types
@@ -1,5 +1,11 @@
-#define KSU_SULOG_MAX_QUEUED 256U
-#define KSU_SULOG_MAX_PAYLOAD_LEN 2048U
+#define KSU_SULOG_DEFAULT_MAX_QUEUED 256U
+#define KSU_SULOG_MIN_QUEUED 16U
+#define KSU_SULOG_MAX_QUEUED_LIMIT 65536U
+#define KSU_SULOG_DEFAULT_MAX_PAYLOAD_LEN 2048U
+#define KSU_SULOG_MIN_PAYLOAD_LEN 256U
+// every capture allocates a max_payload_len buffer on the su path, possibly
+// atomically, and each queued record holds up to that much
+#define KSU_SULOG_MAX_PAYLOAD_LEN_LIMIT 4096U
 #define KSU_SULOG_MAX_ARG_STRINGS 0x7FFFFFFF
 #define KSU_SULOG_MAX_ARG_CHUNK 256U
 #define KSU_SULOG_MAX_FILENAME_LEN 256U
@@ -39,7 +45,7 @@ static void ksu_sulog_set_identity(struct ksu_sulog_event *event, const struct k
 	event->euid = identity->euid;
 }
 
-static struct ksu_sulog_pending_event *ksu_sulog_capture(__u16 event_type, const char *bprm_argv, size_t bprm_argv_len, gfp_t gfp)
+static struct ksu_sulog_pending_event *ksu_sulog_capture(__u16 event_type, const struct ksu_sulog_identity *identity, const char *bprm_argv, size_t bprm_argv_len, gfp_t gfp)
 {
 	struct ksu_sulog_pending_event *pending = NULL;
 	struct ksu_sulog_event *event;
@@ -48,11 +54,16 @@ static struct ksu_sulog_pending_event *ksu_sulog_capture(__u16 event_type, const
 	__u32 filename_len;
 	__u32 argv_len;
 	__u32 remaining;
+	__u32 max_payload_len;
 	char *filename_buf;
 	bool should_skip_copy = false;
 
 	if (!ksu_sulog_is_enabled())
 		return NULL;
+
+	// filter on the audited uid before touching the allocator
+	if (!ksu_sulog_filter_check(event_type, identity ? identity->uid : current_uid().val))
+		return NULL;
 	
 	if (event_type == KSU_SULOG_EVENT_IOCTL_GRANT_ROOT || event_type == KSU_SULOG_EVENT_SUCOMPAT) {
 		filename_len = 0;
@@ -71,21 +82,25 @@ static struct ksu_sulog_pending_event *ksu_sulog_capture(__u16 event_type, const
 		return NULL;
 
 alloc:
+	// sampled once, the cap may be changed at runtime
+	max_payload_len = READ_ONCE(sulog_queue.max_payload_len);
+
 	pending = kzalloc(sizeof(*pending), gfp);
 	if (!pending)
 		goto out_drop;
 
-	payload = kzalloc(KSU_SULOG_MAX_PAYLOAD_LEN, gfp);
+	payload = kzalloc(max_payload_len, gfp);
 	if (!payload)
 		goto out_free_pending;
 
 	event = payload;
 	ksu_sulog_fill_task_info(event, event_type, 0);
+	ksu_sulog_set_identity(event, identity);
 
 	if (should_skip_copy)
 		goto skip_copy;
 
-	remaining = KSU_SULOG_MAX_PAYLOAD_LEN - sizeof(*event);
+	remaining = max_payload_len - sizeof(*event);
 	filename_buf = (char *)payload + sizeof(*event);
 
 	size_t actual_copy_len = bprm_argv_len;
@@ -110,7 +125,7 @@ skip_copy:
 	payload_len = (__u32)sizeof(*event) + filename_len + argv_len;
 
 	// unlikely
-	if (payload_len > KSU_SULOG_MAX_PAYLOAD_LEN || (__u32)sizeof(*event) > payload_len)
+	if (payload_len > max_payload_len || (__u32)sizeof(*event) > payload_len)
 		goto out_free_payload;
 
 	pending->event_type = event_type;
@@ -129,21 +144,30 @@ out_drop:
 
 static struct ksu_sulog_pending_event *ksu_sulog_capture_grant_root(const struct ksu_sulog_identity *identity, gfp_t gfp)
 {
-	struct ksu_sulog_pending_event *pending;
-	struct ksu_sulog_event *event;
+	return ksu_sulog_capture(KSU_SULOG_EVENT_IOCTL_GRANT_ROOT, identity, NULL, 0, gfp);
+}
 
-	pending = ksu_sulog_capture(KSU_SULOG_EVENT_IOCTL_GRANT_ROOT, NULL, 0, gfp);
-	if (!pending)
-		return NULL;
+int ksu_sulog_events_init(void)
+{
+	ksu_event_queue_init(&sulog_queue, KSU_SULOG_DEFAULT_MAX_QUEUED, KSU_SULOG_DEFAULT_MAX_PAYLOAD_LEN);
+	return 0;
+}
 
-	event = pending->payload;
-	ksu_sulog_set_identity(event, identity);
-	return pending;
+int ksu_sulog_set_max_queued(__u32 max_queued)
+{
+	if (max_queued < KSU_SULOG_MIN_QUEUED || max_queued > KSU_SULOG_MAX_QUEUED_LIMIT)
+		return -EINVAL;
+
+	ksu_event_queue_set_max_queued(&sulog_queue, max_queued);
+	return 0;
 }
 
-int ksu_sulog_events_init(void)
+int ksu_sulog_set_max_payload_len(__u32 max_payload_len)
 {
-	ksu_event_queue_init(&sulog_queue, KSU_SULOG_MAX_QUEUED, KSU_SULOG_MAX_PAYLOAD_LEN);
+	if (max_payload_len < KSU_SULOG_MIN_PAYLOAD_LEN || max_payload_len > KSU_SULOG_MAX_PAYLOAD_LEN_LIMIT)
+		return -EINVAL;
+
+	ksu_event_queue_set_max_payload_len(&sulog_queue, max_payload_len);
 	return 0;
 }
 
@@ -160,16 +184,34 @@ static void ksu_sulog_free_pending(struct ksu_sulog_pending_event *pending)
 	kfree(pending);
 }
 
+/*
+ * Coalescing key: everything but pid/tgid/ppid, so a script looping
+ * `su -c` with the same argv folds into one record.
+ */
+static __u64 ksu_sulog_coalesce_key(const struct ksu_sulog_pending_event *pending)
+{
+	const struct ksu_sulog_event *event = pending->payload;
+	size_t offset = offsetof(struct ksu_sulog_event, uid);
+	__u64 seed = ((__u64)pending->event_type << 32) | (__u32)event->retval;
+	__u64 key;
+
+	key = chibihash64((const char *)pending->payload + offset, pending->payload_len - offset, seed);
+	return key ? key : 1;
+}
+
 void ksu_sulog_emit_pending(struct ksu_sulog_pending_event *pending, int retval, gfp_t gfp)
 {
 	struct ksu_sulog_event *event;
+	__u64 key = 0;
 
 	if (!pending)
 		return;
 
 	event = pending->payload;
 	event->retval = retval;
-	ksu_event_queue_push(&sulog_queue, pending->event_type, 0, pending->payload, pending->payload_len, gfp);
+	if (READ_ONCE(sulog_queue.coalesce))
+		key = ksu_sulog_coalesce_key(pending);
+	ksu_event_queue_push_keyed(&sulog_queue, pending->event_type, 0, pending->payload, pending->payload_len, key, gfp);
 	ksu_sulog_free_pending(pending);
 }
 
@@ -199,7 +241,7 @@ static int ksu_sulog_emit(__u16 event_type, const char *bprm_argv, size_t bprm_a
 
 	struct ksu_sulog_pending_event *pending;
 
-	pending = ksu_sulog_capture(event_type, bprm_argv, bprm_argv_len, gfp);
+	pending = ksu_sulog_capture(event_type, NULL, bprm_argv, bprm_argv_len, gfp);
 	if (!pending)
 		return 0;
 
@@ -6,6 +6,8 @@ struct ksu_sulog_pending_event;
 
 int ksu_sulog_events_init(void);
 void ksu_sulog_events_exit(void);
+int ksu_sulog_set_max_queued(__u32 max_queued);
+int ksu_sulog_set_max_payload_len(__u32 max_payload_len);
 
 void ksu_sulog_emit_pending(struct ksu_sulog_pending_event *pending, int retval, gfp_t gfp);
 
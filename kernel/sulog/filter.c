@@ -0,0 +1,268 @@
+#define KSU_SULOG_FILTER_MAX_UID_RULES 32U
+#define KSU_SULOG_FILTER_BUCKET_BITS 6
+#define KSU_SULOG_FILTER_BUCKETS (1U << KSU_SULOG_FILTER_BUCKET_BITS)
+#define KSU_SULOG_FILTER_PROBE 4U
+#define KSU_SULOG_FILTER_MAX_RATE 10000U
+#define KSU_SULOG_FILTER_MAX_BURST 10000U
+#define KSU_SULOG_FILTER_ALL_TYPES (~0U)
+// bits up to the highest event type, anything above can never match
+#define KSU_SULOG_FILTER_KNOWN_TYPES (KSU_SULOG_FILTER_TYPE_BIT(KSU_SULOG_EVENT_IOCTL_GRANT_ROOT + 1) - 1)
+
+struct ksu_sulog_uid_rule {
+	__u32 uid;
+	bool allow;
+};
+
+/*
+ * Token bucket, tokens are kept in 1/HZ units so refill is a plain
+ * multiplication of elapsed jiffies and rate.
+ */
+struct ksu_sulog_rate_bucket {
+	__u32 uid;
+	bool used;
+	unsigned long last;
+	u64 tokens;
+};
+
+static DEFINE_SPINLOCK(sulog_filter_lock);
+
+// fast path: skip the lock entirely when nothing is configured
+static bool sulog_filter_active __read_mostly = false;
+
+static struct ksu_sulog_uid_rule sulog_uid_rules[KSU_SULOG_FILTER_MAX_UID_RULES];
+static __u32 sulog_uid_rule_count;
+static __u32 sulog_allow_rule_count;
+static __u32 sulog_type_mask = KSU_SULOG_FILTER_ALL_TYPES;
+static __u32 sulog_rate;
+static __u32 sulog_burst;
+static struct ksu_sulog_rate_bucket sulog_rate_buckets[KSU_SULOG_FILTER_BUCKETS];
+
+static u64 sulog_filtered_uid;
+static u64 sulog_filtered_type;
+static u64 sulog_filtered_rate;
+
+static void ksu_sulog_filter_update_active_locked(void)
+{
+	bool active = sulog_uid_rule_count || sulog_rate || sulog_type_mask != KSU_SULOG_FILTER_ALL_TYPES;
+
+	WRITE_ONCE(sulog_filter_active, active);
+}
+
+static struct ksu_sulog_uid_rule *ksu_sulog_find_uid_rule_locked(__u32 uid)
+{
+	__u32 i;
+
+	for (i = 0; i < sulog_uid_rule_count; i++) {
+		if (sulog_uid_rules[i].uid == uid)
+			return &sulog_uid_rules[i];
+	}
+
+	return NULL;
+}
+
+static bool ksu_sulog_uid_allowed_locked(__u32 uid)
+{
+	struct ksu_sulog_uid_rule *rule;
+
+	if (!sulog_uid_rule_count)
+		return true;
+
+	rule = ksu_sulog_find_uid_rule_locked(uid);
+	if (rule)
+		return rule->allow;
+
+	// allow rules turn the table into an allowlist
+	return !sulog_allow_rule_count;
+}
+
+static struct ksu_sulog_rate_bucket *ksu_sulog_get_bucket_locked(__u32 uid, unsigned long now)
+{
+	struct ksu_sulog_rate_bucket *bucket;
+	struct ksu_sulog_rate_bucket *victim = NULL;
+	__u32 start = hash_32(uid, KSU_SULOG_FILTER_BUCKET_BITS);
+	__u32 i;
+
+	for (i = 0; i < KSU_SULOG_FILTER_PROBE; i++) {
+		bucket = &sulog_rate_buckets[(start + i) & (KSU_SULOG_FILTER_BUCKETS - 1)];
+		if (bucket->used && bucket->uid == uid)
+			return bucket;
+
+		if (!bucket->used) {
+			if (!victim || victim->used)
+				victim = bucket;
+			continue;
+		}
+
+		if (!victim || (victim->used && time_before(bucket->last, victim->last)))
+			victim = bucket;
+	}
+
+	// evict the least recently seen uid in the probe window, starting it full
+	victim->uid = uid;
+	victim->used = true;
+	victim->last = now;
+	victim->tokens = (u64)sulog_burst * HZ;
+	return victim;
+}
+
+static bool ksu_sulog_rate_allowed_locked(__u32 uid)
+{
+	struct ksu_sulog_rate_bucket *bucket;
+	unsigned long now = jiffies;
+	unsigned long elapsed;
+	u64 cap;
+
+	if (!sulog_rate)
+		return true;
+
+	cap = (u64)sulog_burst * HZ;
+	bucket = ksu_sulog_get_bucket_locked(uid, now);
+
+	elapsed = now - bucket->last;
+	bucket->last = now;
+	// a full refill takes at most cap jiffies, clamp before multiplying
+	if (elapsed > cap)
+		elapsed = cap;
+
+	bucket->tokens = min_t(u64, cap, bucket->tokens + (u64)elapsed * sulog_rate);
+	if (bucket->tokens < HZ)
+		return false;
+
+	bucket->tokens -= HZ;
+	return true;
+}
+
+bool ksu_sulog_filter_check(__u16 event_type, __u32 uid)
+{
+	unsigned long flags;
+	bool pass = true;
+
+	if (!READ_ONCE(sulog_filter_active))
+		return true;
+
+	spin_lock_irqsave(&sulog_filter_lock, flags);
+
+	if (event_type >= 32 || !(sulog_type_mask & KSU_SULOG_FILTER_TYPE_BIT(event_type))) {
+		sulog_filtered_type++;
+		pass = false;
+	} else if (!ksu_sulog_uid_allowed_locked(uid)) {
+		sulog_filtered_uid++;
+		pass = false;
+	} else if (!ksu_sulog_rate_allowed_locked(uid)) {
+		sulog_filtered_rate++;
+		pass = false;
+	}
+
+	spin_unlock_irqrestore(&sulog_filter_lock, flags);
+	return pass;
+}
+
+static void ksu_sulog_filter_reset_locked(void)
+{
+	memset(sulog_uid_rules, 0, sizeof(sulog_uid_rules));
+	memset(sulog_rate_buckets, 0, sizeof(sulog_rate_buckets));
+	sulog_uid_rule_count = 0;
+	sulog_allow_rule_count = 0;
+	sulog_type_mask = KSU_SULOG_FILTER_ALL_TYPES;
+	sulog_rate = 0;
+	sulog_burst = 0;
+	sulog_filtered_uid = 0;
+	sulog_filtered_type = 0;
+	sulog_filtered_rate = 0;
+	ksu_sulog_filter_update_active_locked();
+}
+
+static int ksu_sulog_set_uid_rule_locked(__u32 uid, bool allow)
+{
+	struct ksu_sulog_uid_rule *rule;
+
+	rule = ksu_sulog_find_uid_rule_locked(uid);
+	if (!rule) {
+		if (sulog_uid_rule_count >= KSU_SULOG_FILTER_MAX_UID_RULES)
+			return -ENOSPC;
+
+		rule = &sulog_uid_rules[sulog_uid_rule_count++];
+		rule->uid = uid;
+	} else if (rule->allow) {
+		sulog_allow_rule_count--;
+	}
+
+	rule->allow = allow;
+	if (allow)
+		sulog_allow_rule_count++;
+
+	return 0;
+}
+
+static int ksu_sulog_remove_uid_rule_locked(__u32 uid)
+{
+	struct ksu_sulog_uid_rule *rule;
+
+	rule = ksu_sulog_find_uid_rule_locked(uid);
+	if (!rule)
+		return -ENOENT;
+
+	if (rule->allow)
+		sulog_allow_rule_count--;
+
+	// keep the table dense, order does not matter
+	*rule = sulog_uid_rules[--sulog_uid_rule_count];
+	return 0;
+}
+
+int ksu_sulog_filter_ctl(struct ksu_sulog_filter_cmd *cmd)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	if (cmd->op == KSU_SULOG_FILTER_OP_SET_RATE &&
+	    (cmd->rate > KSU_SULOG_FILTER_MAX_RATE || cmd->burst > KSU_SULOG_FILTER_MAX_BURST || (cmd->rate && !cmd->burst)))
+		return -EINVAL;
+
+	if (cmd->op == KSU_SULOG_FILTER_OP_SET_TYPES && cmd->type_mask != KSU_SULOG_FILTER_ALL_TYPES &&
+	    (cmd->type_mask & ~KSU_SULOG_FILTER_KNOWN_TYPES))
+		return -EINVAL;
+
+	spin_lock_irqsave(&sulog_filter_lock, flags);
+
+	switch (cmd->op) {
+	case KSU_SULOG_FILTER_OP_GET:
+		break;
+	case KSU_SULOG_FILTER_OP_RESET:
+		ksu_sulog_filter_reset_locked();
+		break;
+	case KSU_SULOG_FILTER_OP_ALLOW_UID:
+		ret = ksu_sulog_set_uid_rule_locked(cmd->uid, true);
+		break;
+	case KSU_SULOG_FILTER_OP_DENY_UID:
+		ret = ksu_sulog_set_uid_rule_locked(cmd->uid, false);
+		break;
+	case KSU_SULOG_FILTER_OP_REMOVE_UID:
+		ret = ksu_sulog_remove_uid_rule_locked(cmd->uid);
+		break;
+	case KSU_SULOG_FILTER_OP_SET_TYPES:
+		sulog_type_mask = cmd->type_mask;
+		break;
+	case KSU_SULOG_FILTER_OP_SET_RATE:
+		sulog_rate = cmd->rate;
+		sulog_burst = cmd->rate ? cmd->burst : 0;
+		memset(sulog_rate_buckets, 0, sizeof(sulog_rate_buckets));
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	ksu_sulog_filter_update_active_locked();
+
+	cmd->type_mask = sulog_type_mask;
+	cmd->rate = sulog_rate;
+	cmd->burst = sulog_burst;
+	cmd->uid_rules = sulog_uid_rule_count;
+	cmd->filtered_uid = sulog_filtered_uid;
+	cmd->filtered_type = sulog_filtered_type;
+	cmd->filtered_rate = sulog_filtered_rate;
+
+	spin_unlock_irqrestore(&sulog_filter_lock, flags);
+	return ret;
+}
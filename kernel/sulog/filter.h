@@ -0,0 +1,9 @@
+#ifndef __KSU_H_SULOG_FILTER
+#define __KSU_H_SULOG_FILTER
+
+struct ksu_sulog_filter_cmd;
+
+bool ksu_sulog_filter_check(__u16 event_type, __u32 uid);
+int ksu_sulog_filter_ctl(struct ksu_sulog_filter_cmd *cmd);
+
+#endif
@@ -27,6 +27,8 @@ static int do_get_info(void __user *arg)
 #ifdef MODULE
 	cmd.flags |= KSU_GET_INFO_FLAG_LKM;
 #endif
+	cmd.flags |= KSU_GET_INFO_FLAG_SEPOLICY_COMPACT;
+	cmd.flags |= KSU_GET_INFO_FLAG_SEPOLICY_SETS;
 
 	if (is_manager()) {
 		cmd.flags |= KSU_GET_INFO_FLAG_MANAGER;
@@ -116,6 +118,17 @@ static int do_set_sepolicy(void __user *arg)
 	return handle_sepolicy((void __user *)cmd.data, cmd.data_len);
 }
 
+static int do_sepolicy_txn(void __user *arg)
+{
+	struct ksu_sepolicy_txn_cmd cmd;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		return -EFAULT;
+	}
+
+	return handle_sepolicy_txn(cmd.op, (void __user *)cmd.data, cmd.data_len);
+}
+
 static int do_check_safemode(void __user *arg)
 {
 	struct ksu_check_safemode_cmd cmd;
@@ -488,9 +501,201 @@ static int do_nuke_ext4_sysfs(void __user *arg)
 struct list_head mount_list = LIST_HEAD_INIT(mount_list);
 DECLARE_RWSEM(mount_list_lock);
 
+// mount_list keeps the order for umounting, the hash only answers "is it there"
+#define KSU_MOUNT_HASH_BITS 8
+#define KSU_UMOUNT_BULK_MAX 4096
+static DEFINE_HASHTABLE(mount_hash, KSU_MOUNT_HASH_BITS);
+
+static inline u32 ksu_mount_path_hash(const char *path)
+{
+	return (u32)chibihash64(path, (ptrdiff_t)strlen(path), 0ULL);
+}
+
+static struct mount_entry *ksu_mount_find_locked(const char *path, u32 hash)
+{
+	struct mount_entry *entry;
+
+	hash_for_each_possible (mount_hash, entry, hnode, hash) {
+		if (entry->hash == hash && !strcmp(entry->umountable, path))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void ksu_mount_free(struct mount_entry *entry)
+{
+#ifdef CONFIG_KSU_UMOUNT_STATS
+	ksu_umount_counters_put(entry->counters);
+#endif
+	kfree(entry->umountable);
+	kfree(entry);
+}
+
+static void ksu_mount_remove_locked(struct mount_entry *entry)
+{
+	list_del(&entry->list);
+	hash_del(&entry->hnode);
+	ksu_mount_free(entry);
+}
+
+static struct mount_entry *ksu_mount_alloc(const char *path, unsigned int flags)
+{
+	struct mount_entry *entry = kzalloc(sizeof(*entry), GFP_KERNEL);
+
+	if (!entry)
+		return NULL;
+
+	entry->umountable = kstrdup(path, GFP_KERNEL);
+	if (!entry->umountable) {
+		kfree(entry);
+		return NULL;
+	}
+
+#ifdef CONFIG_KSU_UMOUNT_STATS
+	entry->counters = ksu_umount_counters_new();
+	if (!entry->counters) {
+		ksu_mount_free(entry);
+		return NULL;
+	}
+#endif
+
+	entry->flags = flags;
+	entry->hash = ksu_mount_path_hash(path);
+	INIT_LIST_HEAD(&entry->list);
+	return entry;
+}
+
+// takes ownership of entry, returns -EEXIST and frees it on dupes
+static int ksu_mount_insert_locked(struct mount_entry *entry)
+{
+	if (ksu_mount_find_locked(entry->umountable, entry->hash)) {
+		pr_info("cmd_add_try_umount: %s is already here!\n", entry->umountable);
+		ksu_mount_free(entry);
+		return -EEXIST;
+	}
+
+	list_add(&entry->list, &mount_list);
+	hash_add(mount_hash, &entry->hnode, entry->hash);
+	return 0;
+}
+
+#ifdef CONFIG_KSU_UMOUNT_STATS
+static int ksu_umount_get_stats(void __user *arg)
+{
+	struct ksu_umount_stats_cmd cmd;
+	struct ksu_umount_entry_stats stats;
+	struct ksu_umount_entry_stats __user *out;
+	struct mount_entry *entry;
+	u32 total = 0;
+	u32 filled = 0;
+	int ret = 0;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd)))
+		return -EFAULT;
+
+	out = (struct ksu_umount_entry_stats __user *)(uintptr_t)cmd.entries;
+	memset(&stats, 0, sizeof(stats));
+
+	// same as GETLIST, copying out under the read lock is fine for an rwsem
+	down_read(&mount_list_lock);
+	list_for_each_entry (entry, &mount_list, list) {
+		total++;
+		if (filled >= cmd.count)
+			continue;
+
+		strscpy_pad(stats.path, entry->umountable, sizeof(stats.path));
+		stats.flags = entry->flags;
+		stats.attempts = atomic64_read(&entry->counters->attempts);
+		stats.successes = atomic64_read(&entry->counters->successes);
+		stats.enoent = atomic64_read(&entry->counters->enoent);
+		stats.einval = atomic64_read(&entry->counters->einval);
+		stats.ns = atomic64_read(&entry->counters->ns);
+		if (copy_to_user(&out[filled], &stats, sizeof(stats))) {
+			ret = -EFAULT;
+			break;
+		}
+		filled++;
+	}
+	up_read(&mount_list_lock);
+
+	if (ret)
+		return ret;
+
+	cmd.count = total;
+	cmd.filled = filled;
+	if (copy_to_user(arg, &cmd, sizeof(cmd)))
+		return -EFAULT;
+
+	return 0;
+}
+#endif
+
+/*
+ * Copy the whole list in first so mount_list_lock is taken once and never
+ * held across user faults.
+ */
+static int ksu_umount_add_bulk(const char __user *uptr, unsigned int flags)
+{
+	struct mount_entry *entry, *tmp;
+	LIST_HEAD(staged);
+	char buf[256];
+	int count = 0;
+	int added = 0;
+	int ret = 0;
+
+	for (;;) {
+		long len = strncpy_from_user(buf, uptr, sizeof(buf));
+
+		if (len < 0) {
+			ret = -EFAULT;
+			goto out_free;
+		}
+		if (len == sizeof(buf)) {
+			ret = -ENAMETOOLONG;
+			goto out_free;
+		}
+		if (!len)
+			break;
+
+		if (++count > KSU_UMOUNT_BULK_MAX) {
+			ret = -E2BIG;
+			goto out_free;
+		}
+
+		entry = ksu_mount_alloc(buf, flags);
+		if (!entry) {
+			ret = -ENOMEM;
+			goto out_free;
+		}
+		list_add_tail(&entry->list, &staged);
+		uptr += len + 1;
+	}
+
+	down_write(&mount_list_lock);
+	list_for_each_entry_safe (entry, tmp, &staged, list) {
+		list_del(&entry->list);
+		if (!ksu_mount_insert_locked(entry))
+			added++;
+	}
+	up_write(&mount_list_lock);
+	if (added)
+		ksu_umount_list_changed();
+
+	pr_info("cmd_add_try_umount: bulk added %d of %d\n", added, count);
+	return 0;
+
+out_free:
+	list_for_each_entry_safe (entry, tmp, &staged, list) {
+		list_del(&entry->list);
+		ksu_mount_free(entry);
+	}
+	return ret;
+}
+
 static int add_try_umount(void __user *arg)
 {
-	struct mount_entry *new_entry, *entry, *tmp;
+	struct mount_entry *new_entry, *entry;
 	struct ksu_add_try_umount_cmd cmd;
 	char buf[256] = {0};
 
@@ -503,61 +708,69 @@ static int add_try_umount(void __user *arg)
 			down_write(&mount_list_lock);
 			list_for_each_entry_safe(entry, tmp, &mount_list, list) {
 				pr_info("wipe_umount_list: removing entry: %s\n", entry->umountable);
-				list_del(&entry->list);
-				kfree(entry->umountable);
-				kfree(entry);
+				ksu_mount_remove_locked(entry);
 			}
 			up_write(&mount_list_lock);
+			ksu_umount_list_changed();
 
 			return 0;
 		}
 
 		case KSU_UMOUNT_ADD: {
+			int ret;
 			long len = strncpy_from_user(buf, (const char __user *)cmd.arg, 256);
 			if (len <= 0)
 				return -EFAULT;	
 			
 			buf[sizeof(buf) - 1] = '\0';
 
-			new_entry = kzalloc(sizeof(*new_entry), GFP_KERNEL);
+			new_entry = ksu_mount_alloc(buf, cmd.flags);
 			if (!new_entry)
 				return -ENOMEM;
 
-			new_entry->umountable = kstrdup(buf, GFP_KERNEL);
-			if (!new_entry->umountable) {
-				kfree(new_entry);
-				return -ENOMEM;
-			}
-
+			// disallow dupes
 			down_write(&mount_list_lock);
+			ret = ksu_mount_insert_locked(new_entry);
+			up_write(&mount_list_lock);
+			if (ret)
+				return ret;
 
-			// disallow dupes
-			// if this gets too many, we can consider moving this whole task to a kthread
-			list_for_each_entry(entry, &mount_list, list) {
-				if (!strcmp(entry->umountable, buf)) {
-					pr_info("cmd_add_try_umount: %s is already here!\n", buf);
-					up_write(&mount_list_lock);
-					kfree(new_entry->umountable);
-					kfree(new_entry);
-					return -EEXIST;
-				}
-			}
+			ksu_umount_list_changed();
+			pr_info("cmd_add_try_umount: %s added!\n", buf);
+
+			return 0;
+		}
 
-			// now check flags and add
-			// this also serves as a null check
-			if (cmd.flags)
-				new_entry->flags = cmd.flags;
-			else
-				new_entry->flags = 0;
+		case KSU_UMOUNT_ADD_BULK: {
+			if (!cmd.arg)
+				return -EFAULT;
 
-			// debug
-			list_add(&new_entry->list, &mount_list);
-			up_write(&mount_list_lock);
-			pr_info("cmd_add_try_umount: %s added!\n", buf);
+			return ksu_umount_add_bulk((const char __user *)cmd.arg, cmd.flags);
+		}
+
+		case KSU_UMOUNT_GET_CACHE_STATS: {
+			struct ksu_umount_cache_stats stats;
+
+			if (!cmd.arg)
+				return -EFAULT;
+
+			ksu_umount_get_cache_stats(&stats);
+			if (copy_to_user((void __user *)cmd.arg, &stats, sizeof(stats)))
+				return -EFAULT;
 
 			return 0;
 		}
 
+		case KSU_UMOUNT_GET_STATS: {
+			if (!cmd.arg)
+				return -EFAULT;
+#ifdef CONFIG_KSU_UMOUNT_STATS
+			return ksu_umount_get_stats((void __user *)cmd.arg);
+#else
+			return -EOPNOTSUPP;
+#endif
+		}
+
 		// this is just strcmp'd wipe anyway
 		case KSU_UMOUNT_DEL: {
 			long len = strncpy_from_user(buf, (const char __user *)cmd.arg, sizeof(buf) - 1);
@@ -567,13 +780,11 @@ static int add_try_umount(void __user *arg)
 			buf[sizeof(buf) - 1] = '\0';
 
 			down_write(&mount_list_lock);
-			list_for_each_entry_safe(entry, tmp, &mount_list, list) {
-				if (!strcmp(entry->umountable, buf)) {
-					pr_info("cmd_add_try_umount: entry removed: %s\n", entry->umountable);
-					list_del(&entry->list);
-					kfree(entry->umountable);
-					kfree(entry);
-				}
+			entry = ksu_mount_find_locked(buf, ksu_mount_path_hash(buf));
+			if (entry) {
+				pr_info("cmd_add_try_umount: entry removed: %s\n", entry->umountable);
+				ksu_mount_remove_locked(entry);
+				ksu_umount_list_changed();
 			}
 			up_write(&mount_list_lock);
 			
@@ -692,6 +903,128 @@ static int do_disable_escape_to_root(void __user *arg)
 	return 0;
 }
 
+static int do_sulog_filter(void __user *arg)
+{
+	struct ksu_sulog_filter_cmd cmd;
+	int ret;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("sulog_filter: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	ret = ksu_sulog_filter_ctl(&cmd);
+	if (ret) {
+		pr_err("sulog_filter: op %u failed: %d\n", cmd.op, ret);
+		return ret;
+	}
+
+	if (copy_to_user(arg, &cmd, sizeof(cmd))) {
+		pr_err("sulog_filter: copy_to_user failed\n");
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static const struct ksu_ioctl_cmd_map *ksu_supercall_lookup(unsigned int cmd);
+
+#define KSU_BATCH_PERM_CACHE 8
+
+// permission verdicts cannot change within one call, run each check once
+struct ksu_batch_perm_cache {
+	ksu_perm_check_t check[KSU_BATCH_PERM_CACHE];
+	bool allowed[KSU_BATCH_PERM_CACHE];
+	int nr;
+};
+
+static bool ksu_batch_perm_allowed(struct ksu_batch_perm_cache *cache, ksu_perm_check_t check)
+{
+	bool allowed;
+	int i;
+
+	if (!check)
+		return true;
+
+	for (i = 0; i < cache->nr; i++) {
+		if (cache->check[i] == check)
+			return cache->allowed[i];
+	}
+
+	allowed = check();
+	if (cache->nr < KSU_BATCH_PERM_CACHE) {
+		cache->check[cache->nr] = check;
+		cache->allowed[cache->nr] = allowed;
+		cache->nr++;
+	}
+	return allowed;
+}
+
+static int ksu_batch_run_one(struct ksu_batch_perm_cache *cache, const struct ksu_batch_entry *entry)
+{
+	const struct ksu_ioctl_cmd_map *map;
+
+	// escalation stays a standalone, audited call; no nesting
+	if (entry->cmd == KSU_IOCTL_GRANT_ROOT || entry->cmd == KSU_IOCTL_BATCH)
+		return -EINVAL;
+
+	map = ksu_supercall_lookup(entry->cmd);
+	if (!map)
+		return -ENOTTY;
+
+	if (!ksu_batch_perm_allowed(cache, map->perm_check))
+		return -EPERM;
+
+	return map->handler((void __user *)entry->arg);
+}
+
+static int do_batch(void __user *arg)
+{
+	struct ksu_batch_cmd cmd;
+	struct ksu_batch_entry entry;
+	struct ksu_batch_entry __user *entries;
+	struct ksu_batch_perm_cache cache = { .nr = 0 };
+	__u32 i;
+	int ret = 0;
+
+	if (copy_from_user(&cmd, arg, sizeof(cmd))) {
+		pr_err("batch: copy_from_user failed\n");
+		return -EFAULT;
+	}
+
+	if (!cmd.count || cmd.count > KSU_BATCH_MAX_ENTRIES)
+		return -EINVAL;
+
+	entries = (struct ksu_batch_entry __user *)cmd.entries;
+	for (i = 0; i < cmd.count; i++) {
+		if (copy_from_user(&entry, &entries[i], sizeof(entry))) {
+			ret = -EFAULT;
+			break;
+		}
+
+		entry.result = ksu_batch_run_one(&cache, &entry);
+		if (put_user(entry.result, &entries[i].result)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		if (fatal_signal_pending(current)) {
+			i++;
+			ret = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+
+	cmd.completed = i;
+	if (copy_to_user((char __user *)arg + offsetof(struct ksu_batch_cmd, completed), &cmd.completed, sizeof(cmd.completed))) {
+		pr_err("batch: copy_to_user failed\n");
+		return -EFAULT;
+	}
+
+	return ret;
+}
+
 // IOCTL handlers mapping table
 static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
 	{ .cmd = KSU_IOCTL_GRANT_ROOT, .name = "GRANT_ROOT", .handler = do_grant_root, .perm_check = allowed_for_su },
@@ -718,31 +1051,106 @@ static const struct ksu_ioctl_cmd_map ksu_ioctl_handlers[] = {
 	{ .cmd = KSU_IOCTL_SET_INIT_PGRP, .name = "SET_INIT_PGRP", .handler = do_set_init_pgrp, .perm_check = only_root },
 	{ .cmd = KSU_IOCTL_GET_SULOG_FD, .name = "GET_SULOG_FD", .handler = do_get_sulog_fd, .perm_check = only_root },
 	{ .cmd = KSU_IOCTL_DISABLE_ESCAPE_TO_ROOT, .name = "DISABLE_ESCAPE_TO_ROOT", .handler = do_disable_escape_to_root, .perm_check = only_root },
+	{ .cmd = KSU_IOCTL_SULOG_FILTER, .name = "SULOG_FILTER", .handler = do_sulog_filter, .perm_check = only_root },
+	{ .cmd = KSU_IOCTL_SEPOLICY_TXN, .name = "SEPOLICY_TXN", .handler = do_sepolicy_txn, .perm_check = only_root },
+	// sub-commands are checked one by one
+	{ .cmd = KSU_IOCTL_BATCH, .name = "BATCH", .handler = do_batch, .perm_check = always_allow },
 	{ .cmd = 0, .name = NULL, .handler = NULL, .perm_check = NULL } // Sentinel
 };
 
+/*
+ * Direct index by _IOC_NR. A few numbers are shared by a legacy and a sized
+ * variant of the same call (GET_INFO, GET_ALLOW_LIST, ...), so every slot
+ * holds up to two entries and the full cmd still has to match.
+ */
+#define KSU_IOCTL_NR_SLOTS 64
+#define KSU_IOCTL_NR_VARIANTS 2
+
+static const struct ksu_ioctl_cmd_map *ksu_ioctl_index[KSU_IOCTL_NR_SLOTS][KSU_IOCTL_NR_VARIANTS] __read_mostly;
+
+static const struct ksu_ioctl_cmd_map *ksu_supercall_lookup(unsigned int cmd)
+{
+	const struct ksu_ioctl_cmd_map *const *slot;
+	unsigned int nr = _IOC_NR(cmd);
+
+	if (unlikely(_IOC_TYPE(cmd) != 'K' || nr >= KSU_IOCTL_NR_SLOTS))
+		return NULL;
+
+	slot = ksu_ioctl_index[nr];
+	if (slot[0] && slot[0]->cmd == cmd)
+		return slot[0];
+	if (slot[1] && slot[1]->cmd == cmd)
+		return slot[1];
+
+	return NULL;
+}
+
+int __init ksu_supercall_build_index(void)
+{
+	const struct ksu_ioctl_cmd_map *entry;
+	const struct ksu_ioctl_cmd_map **slot;
+	unsigned int nr;
+	int i, j;
+	int ret = 0;
+
+	memset(ksu_ioctl_index, 0, sizeof(ksu_ioctl_index));
+
+	for (i = 0; ksu_ioctl_handlers[i].handler; i++) {
+		entry = &ksu_ioctl_handlers[i];
+		nr = _IOC_NR(entry->cmd);
+
+		if (_IOC_TYPE(entry->cmd) != 'K' || nr >= KSU_IOCTL_NR_SLOTS) {
+			pr_err("ksu ioctl: %s (0x%08x) out of dispatch range\n", entry->name, entry->cmd);
+			ret = -EINVAL;
+			continue;
+		}
+
+		slot = ksu_ioctl_index[nr];
+		for (j = 0; j < KSU_IOCTL_NR_VARIANTS && slot[j]; j++) {
+			if (slot[j]->cmd == entry->cmd)
+				break;
+		}
+
+		if (j < KSU_IOCTL_NR_VARIANTS && slot[j]) {
+			pr_err("ksu ioctl: %s duplicates %s (0x%08x)\n", entry->name, slot[j]->name, entry->cmd);
+			ret = -EEXIST;
+			continue;
+		}
+
+		if (j == KSU_IOCTL_NR_VARIANTS) {
+			pr_err("ksu ioctl: too many commands share nr %u, %s is unreachable\n", nr, entry->name);
+			ret = -ENOSPC;
+			continue;
+		}
+
+		slot[j] = entry;
+	}
+
+	return ret;
+}
+
 long ksu_supercall_handle_ioctl(unsigned int cmd, void __user *argp)
 {
-	int i;
+	const struct ksu_ioctl_cmd_map *entry;
 
 #ifdef CONFIG_KSU_DEBUG
 	pr_info("ksu ioctl: cmd=0x%x from uid=%d\n", cmd, current_uid().val);
 #endif
 
-	for (i = 0; ksu_ioctl_handlers[i].handler; i++) {
-		if (cmd == ksu_ioctl_handlers[i].cmd) {
-			// Check permission first
-			if (ksu_ioctl_handlers[i].perm_check && !ksu_ioctl_handlers[i].perm_check()) {
-				pr_warn("ksu ioctl: permission denied for cmd=0x%x uid=%d\n", cmd, current_uid().val);
-				return -EPERM;
-			}
-			// Execute handler
-			return ksu_ioctl_handlers[i].handler(argp);
-		}
+	entry = ksu_supercall_lookup(cmd);
+	if (!entry) {
+		pr_warn("ksu ioctl: unsupported command 0x%x\n", cmd);
+		return -ENOTTY;
+	}
+
+	// Check permission first
+	if (entry->perm_check && !entry->perm_check()) {
+		pr_warn("ksu ioctl: permission denied for cmd=0x%x uid=%d\n", cmd, current_uid().val);
+		return -EPERM;
 	}
 
-	pr_warn("ksu ioctl: unsupported command 0x%x\n", cmd);
-	return -ENOTTY;
+	// Execute handler
+	return entry->handler(argp);
 }
 
 void __init ksu_supercall_dump_commands(void)
@@ -7,6 +7,7 @@ bool manager_or_root(void);
 bool always_allow(void);
 bool allowed_for_su(void);
 
+int ksu_supercall_build_index(void);
 long ksu_supercall_handle_ioctl(unsigned int cmd, void __user *argp);
 void ksu_supercall_dump_commands(void);
 void ksu_supercall_cleanup_state(void);
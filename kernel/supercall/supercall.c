@@ -1,5 +1,6 @@
 static int anon_ksu_release(struct inode *inode, struct file *filp)
 {
+	ksu_sepolicy_txn_release();
 	pr_info("ksu fd released\n");
 	return 0;
 }
@@ -204,6 +205,8 @@ int ksu_handle_sys_reboot(int magic1, int magic2, unsigned int cmd, void __user
 
 void __init ksu_supercalls_init(void)
 {
+	if (ksu_supercall_build_index())
+		pr_err("ksu ioctl: dispatch table has conflicting entries\n");
 	ksu_supercall_dump_commands();
 	
 	tiny_sulog_init_heap(); // grab heap memory for sulog
@@ -8,6 +8,7 @@
 
 #include <android/log.h>
 #include <cstring>
+#include <vector>
 
 #include "ksu.h"
 #include "logging.h"
@@ -75,7 +76,7 @@ Java_me_weishu_kernelsu_Natives_isPrBuild(JNIEnv *env, jclass clazz) {
     return is_pr_build();
 }
 
-static void fillIntArray(JNIEnv *env, jobject list, int *data, int count) {
+static void fillIntArray(JNIEnv *env, jobject list, const int *data, int count) {
     auto cls = env->GetObjectClass(list);
     auto add = env->GetMethodID(cls, "add", "(Ljava/lang/Object;)Z");
     auto integerCls = env->FindClass("java/lang/Integer");
@@ -132,26 +133,22 @@ static void fillArrayWithList(JNIEnv *env, jobject list, int *data, int count) {
     }
 }
 
-extern "C"
-JNIEXPORT jobject JNICALL
-Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg, jint uid) {
-    if (env->GetStringLength(pkg) > KSU_MAX_PACKAGE_NAME) {
-        return nullptr;
+static bool initProfileKey(JNIEnv *env, jstring pkg, jint uid, app_profile *profile) {
+    if (!pkg || env->GetStringLength(pkg) > KSU_MAX_PACKAGE_NAME) {
+        return false;
     }
 
-    p_key_t key = {};
     auto cpkg = env->GetStringUTFChars(pkg, nullptr);
-    strcpy(key, cpkg);
+    *profile = {};
+    profile->version = KSU_APP_PROFILE_VER;
+    strncpy(profile->key, cpkg, sizeof(profile->key) - 1);
     env->ReleaseStringUTFChars(pkg, cpkg);
 
-    app_profile profile = {};
-    profile.version = KSU_APP_PROFILE_VER;
-
-    strcpy(profile.key, key);
-    profile.curr_uid = uid;
-
-    bool useDefaultProfile = get_app_profile(&profile) != 0;
+    profile->curr_uid = uid;
+    return true;
+}
 
+static jobject newProfileObject(JNIEnv *env, const app_profile &profile, bool useDefaultProfile) {
     auto cls = env->FindClass("me/weishu/kernelsu/Natives$Profile");
     auto constructor = env->GetMethodID(cls, "<init>", "()V");
     auto obj = env->NewObject(cls, constructor);
@@ -179,7 +176,7 @@ Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg,
     if (useDefaultProfile) {
         // no profile found, so just use default profile:
         // don't allow root and use default profile!
-        LOGD("use default profile for: %s, %d", key, uid);
+        LOGD("use default profile for: %s, %d", profile.key, profile.curr_uid);
 
         // allow_su = false
         // non root use default = true
@@ -230,6 +227,54 @@ Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg,
     return obj;
 }
 
+extern "C"
+JNIEXPORT jobject JNICALL
+Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg, jint uid) {
+    app_profile profile = {};
+    if (!initProfileKey(env, pkg, uid, &profile)) {
+        return nullptr;
+    }
+
+    bool useDefaultProfile = get_app_profile(&profile) != 0;
+    return newProfileObject(env, profile, useDefaultProfile);
+}
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL
+Java_me_weishu_kernelsu_Natives_getAppProfiles(JNIEnv *env, jobject, jobjectArray pkgs, jintArray uids) {
+    auto count = env->GetArrayLength(pkgs);
+    if (env->GetArrayLength(uids) != count) {
+        return nullptr;
+    }
+
+    std::vector<app_profile> profiles(count);
+    std::vector<int> results(count, -1);
+    std::vector<bool> valid(count);
+    auto cuids = env->GetIntArrayElements(uids, nullptr);
+    for (jsize i = 0; i < count; ++i) {
+        auto pkg = (jstring) env->GetObjectArrayElement(pkgs, i);
+        valid[i] = initProfileKey(env, pkg, cuids[i], &profiles[i]);
+        env->DeleteLocalRef(pkg);
+    }
+    env->ReleaseIntArrayElements(uids, cuids, JNI_ABORT);
+
+    get_app_profiles(profiles.data(), results.data(), profiles.size());
+
+    auto cls = env->FindClass("me/weishu/kernelsu/Natives$Profile");
+    auto array = env->NewObjectArray(count, cls, nullptr);
+    for (jsize i = 0; i < count; ++i) {
+        if (!valid[i]) {
+            continue;
+        }
+        // each profile creates a bunch of local refs, drop them per element
+        env->PushLocalFrame(32);
+        auto obj = env->PopLocalFrame(newProfileObject(env, profiles[i], results[i] != 0));
+        env->SetObjectArrayElement(array, i, obj);
+        env->DeleteLocalRef(obj);
+    }
+    return array;
+}
+
 extern "C"
 JNIEXPORT jboolean JNICALL
 Java_me_weishu_kernelsu_Natives_setAppProfile(JNIEnv *env, jobject clazz, jobject profile) {
@@ -16,6 +16,8 @@
 #include <climits>
 #include <sys/syscall.h>
 #include <cerrno>
+#include <algorithm>
+#include <vector>
 #include "ksu.h"
 
 static int fd = -1;
@@ -163,6 +165,44 @@ int get_app_profile(app_profile *profile) {
     return ret;
 }
 
+static bool batch_unsupported = false;
+
+void get_app_profiles(app_profile *profiles, int *results, size_t count) {
+    size_t done = 0;
+    while (done < count && !batch_unsupported) {
+        size_t n = std::min<size_t>(count - done, KSU_BATCH_MAX_ENTRIES);
+        std::vector<ksu_get_app_profile_cmd> cmds(n);
+        std::vector<ksu_batch_entry> entries(n);
+        for (size_t i = 0; i < n; i++) {
+            cmds[i].profile = profiles[done + i];
+            entries[i].cmd = KSU_IOCTL_GET_APP_PROFILE;
+            entries[i].arg = (uint64_t) (uintptr_t) &cmds[i];
+        }
+
+        struct ksu_batch_cmd cmd = {};
+        cmd.count = n;
+        cmd.entries = (uint64_t) (uintptr_t) entries.data();
+        if (ksuctl(KSU_IOCTL_BATCH, &cmd) < 0 && cmd.completed == 0) {
+            // kernel predates KSU_IOCTL_BATCH
+            if (errno == ENOTTY || errno == EINVAL) {
+                batch_unsupported = true;
+            }
+            break;
+        }
+
+        for (size_t i = 0; i < cmd.completed; i++) {
+            profiles[done + i] = cmds[i].profile;
+            results[done + i] = entries[i].result;
+        }
+        done += cmd.completed;
+    }
+
+    // one by one for old kernels and whatever the batch did not reach
+    for (; done < count; done++) {
+        results[done] = get_app_profile(&profiles[done]);
+    }
+}
+
 bool set_su_enabled(bool enabled) {
     struct ksu_set_feature_cmd cmd = {};
     cmd.feature_id = KSU_FEATURE_SU_COMPAT;
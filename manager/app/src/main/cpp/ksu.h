@@ -5,6 +5,7 @@
 #ifndef KERNELSU_KSU_H
 #define KERNELSU_KSU_H
 
+#include <cstddef>
 #include <cstdint>
 #include <sys/ioctl.h>
 #include <sys/prctl.h>
@@ -36,6 +37,9 @@ bool set_app_profile(const app_profile *profile);
 
 int get_app_profile(app_profile *profile);
 
+// Fetch many profiles in one supercall, results[i] is 0 if profiles[i] was found
+void get_app_profiles(app_profile *profiles, int *results, size_t count);
+
 // Su compat
 bool set_su_enabled(bool enabled);
 
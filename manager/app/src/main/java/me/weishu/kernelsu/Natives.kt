@@ -60,6 +60,12 @@ object Natives {
      * @return return null if failed.
      */
     external fun getAppProfile(key: String?, uid: Int): Profile
+
+    /**
+     * Batched [getAppProfile], fetches all profiles in as few kernel calls as possible.
+     * An element is null when its key is invalid.
+     */
+    external fun getAppProfiles(keys: Array<String>, uids: IntArray): Array<Profile?>
     external fun setAppProfile(profile: Profile?): Boolean
 
     /**
@@ -66,17 +66,20 @@ class SuperUserRepositoryImpl : SuperUserRepository {
                     iface.getPackages(0)
                 }
 
-                val packages = slice.list
-                val newApps = packages.filter {
+                val packages = slice.list.filter {
                     val ai = it.applicationInfo ?: return@filter false
                     (ai.flags and ApplicationInfo.FLAG_HAS_CODE) != 0
-                }.map {
+                }
+                val profiles = Natives.getAppProfiles(
+                    packages.map { it.packageName }.toTypedArray(),
+                    packages.map { it.applicationInfo!!.uid }.toIntArray(),
+                )
+                val newApps = packages.mapIndexed { index, it ->
                     val appInfo = it.applicationInfo!!
-                    val profile = Natives.getAppProfile(it.packageName, appInfo.uid)
                     AppInfo(
                         label = appInfo.loadLabel(pm).toString(),
                         packageInfo = it,
-                        profile = profile,
+                        profile = profiles[index],
                     )
                 }
 
@@ -94,9 +97,12 @@ class SuperUserRepositoryImpl : SuperUserRepository {
         runCatching {
             if (currentApps.isEmpty()) return@runCatching emptyList()
 
-            currentApps.map {
-                val profile = Natives.getAppProfile(it.packageName, it.uid)
-                it.copy(profile = profile)
+            val profiles = Natives.getAppProfiles(
+                currentApps.map { it.packageName }.toTypedArray(),
+                currentApps.map { it.uid }.toIntArray(),
+            )
+            currentApps.mapIndexed { index, it ->
+                it.copy(profile = profiles[index])
             }
         }
     }
@@ -25,6 +25,8 @@ static const __u32 KSU_GET_INFO_FLAG_LKM = (1U << 0);
 static const __u32 KSU_GET_INFO_FLAG_MANAGER = (1U << 1);
 static const __u32 KSU_GET_INFO_FLAG_LATE_LOAD = (1U << 2);
 static const __u32 KSU_GET_INFO_FLAG_PR_BUILD = (1U << 3);
+static const __u32 KSU_GET_INFO_FLAG_SEPOLICY_COMPACT = (1U << 4); /* SET_SEPOLICY takes the compact payload */
+static const __u32 KSU_GET_INFO_FLAG_SEPOLICY_SETS = (1U << 5); /* compact payload may carry sets */
 
 struct ksu_get_info_cmd {
     __u32 version; /* Output: KERNEL_SU_VERSION */
@@ -48,6 +50,18 @@ struct ksu_set_sepolicy_cmd {
     __aligned_u64 data; /* Input: pointer to serialized payload */
 };
 
+static const __u32 KSU_SEPOLICY_TXN_BEGIN = 0; /* open an empty transaction */
+static const __u32 KSU_SEPOLICY_TXN_APPEND = 1; /* check and queue a SET_SEPOLICY style payload, returns its command count */
+static const __u32 KSU_SEPOLICY_TXN_COMMIT = 2; /* apply the queue with one policy update and AVC reset, returns total applied count */
+static const __u32 KSU_SEPOLICY_TXN_ABORT = 3; /* drop the queue */
+
+struct ksu_sepolicy_txn_cmd {
+    __u32 op; /* Input: KSU_SEPOLICY_TXN_* */
+    __u32 _pad;
+    __u64 data_len; /* Input: APPEND only, bytes of serialized command payload */
+    __aligned_u64 data; /* Input: APPEND only, pointer to serialized payload */
+};
+
 struct ksu_sepolicy_cmd_hdr {
     __u32 cmd; /* Input: command type, CMD_* */
     __u32 subcmd; /* Input: command subtype */
@@ -64,6 +78,40 @@ struct ksu_sepolicy_cmd_hdr {
  * KSU_SEPOLICY_CMD_GENFSCON=3.
  */
 
+static const __u32 KSU_SEPOLICY_COMPACT_MAGIC = 0x32504553U; /* "SEP2", never a valid cmd */
+static const __u32 KSU_SEPOLICY_COMPACT_REF16 = (1U << 0); /* string refs are __u16, __u32 otherwise */
+static const __u32 KSU_SEPOLICY_COMPACT_SETS = (1U << 1); /* a set table follows the string table */
+
+struct ksu_sepolicy_compact_hdr {
+    __u32 magic; /* Input: KSU_SEPOLICY_COMPACT_MAGIC */
+    __u32 flags; /* Input: KSU_SEPOLICY_COMPACT_* bits */
+    __u32 nstrings; /* Input: entries in the string table */
+    __u32 strings_len; /* Input: bytes of the string table */
+};
+
+struct ksu_sepolicy_compact_sets {
+    __u32 nsets; /* Input: entries in the set table */
+    __u32 nrefs; /* Input: refs that make up the set table */
+};
+
+struct ksu_sepolicy_compact_group {
+    __u32 cmd; /* Input: command type, CMD_* */
+    __u32 subcmd; /* Input: command subtype */
+    __u32 count; /* Input: commands in this group */
+};
+/*
+ * Compact payload, announced by KSU_GET_INFO_FLAG_SEPOLICY_COMPACT:
+ * ksu_sepolicy_compact_hdr, then nstrings '\0' terminated strings, then
+ * groups until the end of the payload. Each ksu_sepolicy_compact_group is
+ * followed by count * argc string refs, ref 0 is ALL and ref n is string
+ * n - 1. Groups are runs of the same cmd/subcmd, commands keep their order.
+ * With KSU_SEPOLICY_COMPACT_SETS the string table is followed by
+ * ksu_sepolicy_compact_sets and nrefs refs, each set being its member count
+ * and then that many string refs. Ref nstrings + n is set n - 1, a command
+ * with set arguments runs once per combination, last argument varying
+ * fastest, like nested loops over { a b } { c d } would.
+ */
+
 struct ksu_check_safemode_cmd {
     __u8 in_safe_mode; /* Output: true if in safe mode, false otherwise */
 };
@@ -144,9 +192,71 @@ struct ksu_get_sulog_fd_cmd {
     __u32 flags; /* Input: reserved for future use, must be 0 */
 };
 
+struct ksu_sulog_filter_cmd {
+    __u32 op; /* Input: KSU_SULOG_FILTER_OP_* */
+    __u32 uid; /* Input: target uid for uid rule ops */
+    __u32 type_mask; /* Input/Output: bitmask of (1 << event_type) to keep */
+    __u32 rate; /* Input/Output: per-uid events per second, 0 disables rate limiting */
+    __u32 burst; /* Input/Output: per-uid token bucket depth */
+    __u32 uid_rules; /* Output: number of active uid rules */
+    __u64 filtered_uid; /* Output: events dropped by uid rules */
+    __u64 filtered_type; /* Output: events dropped by type mask */
+    __u64 filtered_rate; /* Output: events dropped by rate limit */
+};
+
+static const __u32 KSU_SULOG_FILTER_OP_GET = 0; /* only fill outputs */
+static const __u32 KSU_SULOG_FILTER_OP_RESET = 1; /* drop all rules and counters */
+static const __u32 KSU_SULOG_FILTER_OP_ALLOW_UID = 2; /* once any allow rule exists, only allowed uids are logged */
+static const __u32 KSU_SULOG_FILTER_OP_DENY_UID = 3; /* never log this uid */
+static const __u32 KSU_SULOG_FILTER_OP_REMOVE_UID = 4; /* remove uid rule */
+static const __u32 KSU_SULOG_FILTER_OP_SET_TYPES = 5; /* set type_mask */
+static const __u32 KSU_SULOG_FILTER_OP_SET_RATE = 6; /* set rate + burst */
+
+struct ksu_batch_entry {
+    __u32 cmd; /* Input: KSU_IOCTL_* to run, GRANT_ROOT and BATCH are refused */
+    __s32 result; /* Output: return value of that command */
+    __aligned_u64 arg; /* Input: argument pointer for that command */
+};
+
+struct ksu_batch_cmd {
+    __u32 count; /* Input: number of entries, at most KSU_BATCH_MAX_ENTRIES */
+    __u32 completed; /* Output: entries that ran, the rest were not touched */
+    __aligned_u64 entries; /* Input: pointer to struct ksu_batch_entry[count] */
+};
+
+static const __u32 KSU_BATCH_MAX_ENTRIES = 1024;
+
 static const __u8 KSU_UMOUNT_WIPE = 0; /* ignore everything and wipe list */
 static const __u8 KSU_UMOUNT_ADD = 1; /* add entry (path + flags) */
 static const __u8 KSU_UMOUNT_DEL = 2; /* delete entry, strcmp */
+static const __u8 KSU_UMOUNT_ADD_BULK = 3; /* add every path of a "a\0b\0...\0\0" list with the same flags */
+static const __u8 KSU_UMOUNT_GET_CACHE_STATS = 4; /* copy struct ksu_umount_cache_stats to arg */
+
+struct ksu_umount_cache_stats {
+    __u64 hits; /* forks served from the per zygote namespace cache */
+    __u64 misses; /* forks that walked the whole list */
+    __u64 skipped; /* cache hits with nothing left to umount */
+    __u64 avoided; /* list entries not looked up thanks to the cache */
+};
+
+static const __u8 KSU_UMOUNT_GET_STATS = 5; /* fill struct ksu_umount_stats_cmd at arg, -EOPNOTSUPP without CONFIG_KSU_UMOUNT_STATS */
+
+struct ksu_umount_entry_stats {
+    char path[256];
+    __u32 flags;
+    __u32 _pad;
+    __u64 attempts; /* lookups on app fork */
+    __u64 successes; /* umounted */
+    __u64 enoent; /* path did not exist */
+    __u64 einval; /* not a mount root, or umount said EINVAL */
+    __u64 ns; /* total time spent on this entry */
+};
+
+struct ksu_umount_stats_cmd {
+    __u32 count; /* Input: room in entries, Output: entries in the list */
+    __u32 filled; /* Output: entries written */
+    __aligned_u64 entries; /* Input: pointer to struct ksu_umount_entry_stats[count] */
+};
 
 /* IOCTL command definitions */
 static const __u32 KSU_IOCTL_GRANT_ROOT = _IOC(_IOC_NONE, 'K', 1, 0);
@@ -176,5 +286,8 @@ static const __u32 KSU_IOCTL_ADD_TRY_UMOUNT = _IOC(_IOC_WRITE, 'K', 18, 0);
 static const __u32 KSU_IOCTL_SET_INIT_PGRP = _IO('K', 19);
 static const __u32 KSU_IOCTL_GET_SULOG_FD = _IOW('K', 20, struct ksu_get_sulog_fd_cmd);
 static const __u32 KSU_IOCTL_DISABLE_ESCAPE_TO_ROOT = _IO('K', 21);
+static const __u32 KSU_IOCTL_SULOG_FILTER = _IOWR('K', 22, struct ksu_sulog_filter_cmd);
+static const __u32 KSU_IOCTL_BATCH = _IOWR('K', 23, struct ksu_batch_cmd);
+static const __u32 KSU_IOCTL_SEPOLICY_TXN = _IOW('K', 24, struct ksu_sepolicy_txn_cmd);
 
 #endif
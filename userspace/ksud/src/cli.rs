@@ -39,6 +39,12 @@ enum Commands {
     #[command(hide = true)]
     Sulogd,
 
+    /// Inspect stored sulog records
+    Sulog {
+        #[command(subcommand)]
+        command: SulogCmd,
+    },
+
     /// Trigger `boot-complete` event
     BootCompleted,
 
@@ -417,7 +423,7 @@ enum Profile {
 enum Feature {
     /// Get feature value and support status
     Get {
-        /// Feature ID or name (su_compat, kernel_umount, sulog, adb_root, selinux_hide, webview_zygote_umount)
+        /// Feature ID or name (su_compat, kernel_umount, sulog, adb_root, selinux_hide, webview_zygote_umount, sulog_coalesce, sulog_max_queued, sulog_max_payload, sulog_clock, kernel_umount_defer, kernel_umount_ns_cache)
         id: String,
         /// Read from config file
         #[arg(long, default_value_t = false)]
@@ -428,7 +434,7 @@ enum Feature {
     Set {
         /// Feature ID or name
         id: String,
-        /// Feature value (0=disable, 1=enable)
+        /// Feature value (0=disable, 1=enable; sizes for sulog_max_*)
         value: u64,
     },
 
@@ -437,7 +443,7 @@ enum Feature {
 
     /// Check feature status (supported/unsupported/managed)
     Check {
-        /// Feature ID or name (su_compat, kernel_umount, sulog, adb_root, selinux_hide, webview_zygote_umount)
+        /// Feature ID or name (su_compat, kernel_umount, sulog, adb_root, selinux_hide, webview_zygote_umount, sulog_coalesce, sulog_max_queued, sulog_max_payload, sulog_clock, kernel_umount_defer, kernel_umount_ns_cache)
         id: String,
     },
 
@@ -462,14 +468,56 @@ enum Kernel {
     },
     /// Notify that module is mounted
     NotifyModuleMounted,
+    /// Manage in-kernel sulog filter
+    SulogFilter {
+        #[command(subcommand)]
+        command: SulogFilterOp,
+    },
+}
+
+#[derive(clap::Subcommand, Debug)]
+enum SulogFilterOp {
+    /// Show filter config and filtered event counters
+    Show,
+    /// Drop all filter rules and reset counters
+    Reset,
+    /// Log this uid; once any uid is allowed, other uids are filtered
+    Allow {
+        /// target uid
+        uid: u32,
+    },
+    /// Never log this uid
+    Deny {
+        /// target uid
+        uid: u32,
+    },
+    /// Remove allow/deny rule of this uid
+    Remove {
+        /// target uid
+        uid: u32,
+    },
+    /// Only log these event types (root_execve, sucompat, ioctl_grant_root), none means all
+    Types {
+        /// event type names or ids
+        types: Vec<String>,
+    },
+    /// Limit events per uid with a token bucket, 0 disables
+    Rate {
+        /// events per second per uid
+        rate: u32,
+        /// bucket depth (default: same as rate)
+        #[arg(short, long)]
+        burst: Option<u32>,
+    },
 }
 
 #[derive(clap::Subcommand, Debug)]
 enum UmountOp {
-    /// Add mount point to umount list
+    /// Add mount points to umount list
     Add {
-        /// mount point path
-        mnt: String,
+        /// mount point paths, several are added in one kernel call
+        #[arg(required = true)]
+        mnt: Vec<String>,
         /// umount flags (default: 0, MNT_DETACH: 2)
         #[arg(short, long, default_value = "0")]
         flags: u32,
@@ -481,6 +529,30 @@ enum UmountOp {
     },
     /// Wipe all entries from umount list
     Wipe,
+    /// Show umount cache counters and, if built in, per-entry outcomes
+    Stats,
+}
+
+#[derive(clap::Subcommand, Debug)]
+enum SulogCmd {
+    /// Query binary sulog segments (needs log.format=binary or both)
+    Query {
+        /// only records of this uid
+        #[arg(short, long)]
+        uid: Option<u32>,
+        /// start time, local "YYYY-MM-DD" or "YYYY-MM-DD HH:MM"
+        #[arg(long)]
+        since: Option<String>,
+        /// end time (inclusive), same format as --since
+        #[arg(long)]
+        until: Option<String>,
+        /// only these event types (root_execve, sucompat, ioctl_grant_root)
+        #[arg(short = 't', long = "type")]
+        types: Vec<String>,
+        /// stop after this many records
+        #[arg(short = 'n', long)]
+        limit: Option<usize>,
+    },
 }
 
 #[derive(clap::Subcommand, Debug)]
@@ -666,6 +738,15 @@ pub fn run() -> Result<()> {
             Ok(())
         }
         Commands::Sulogd => sulog::run_sulogd(),
+        Commands::Sulog { command } => match command {
+            SulogCmd::Query {
+                uid,
+                since,
+                until,
+                types,
+                limit,
+            } => sulog::query(uid, since.as_deref(), until.as_deref(), &types, limit),
+        },
         Commands::Profile { command } => match command {
             Profile::GetSepolicy { package } => crate::profile::get_sepolicy(package),
             Profile::SetSepolicy { package, policy } => {
@@ -793,14 +874,73 @@ pub fn run() -> Result<()> {
         Commands::Kernel { command } => match command {
             Kernel::NukeExt4Sysfs { mnt } => ksucalls::nuke_ext4_sysfs(&mnt),
             Kernel::Umount { command } => match command {
-                UmountOp::Add { mnt, flags } => ksucalls::umount_list_add(&mnt, flags),
+                UmountOp::Add { mnt, flags } => match mnt.as_slice() {
+                    [single] => ksucalls::umount_list_add(single, flags),
+                    _ => ksucalls::umount_list_add_bulk(&mnt, flags),
+                },
                 UmountOp::Del { mnt } => ksucalls::umount_list_del(&mnt),
                 UmountOp::Wipe => ksucalls::umount_list_wipe().map_err(Into::into),
+                UmountOp::Stats => {
+                    let stats = ksucalls::umount_cache_stats()?;
+                    println!("hits: {}", stats.hits);
+                    println!("misses: {}", stats.misses);
+                    println!("skipped: {}", stats.skipped);
+                    println!("avoided: {}", stats.avoided);
+                    if let Some(entries) = ksucalls::umount_entry_stats()? {
+                        for entry in &entries {
+                            let path = unsafe { std::ffi::CStr::from_ptr(entry.path.as_ptr()) };
+                            println!(
+                                "{} flags=0x{:x} attempts={} ok={} enoent={} einval={} time={}us",
+                                path.to_string_lossy(),
+                                entry.flags,
+                                entry.attempts,
+                                entry.successes,
+                                entry.enoent,
+                                entry.einval,
+                                entry.ns / 1000
+                            );
+                        }
+                    }
+                    Ok(())
+                }
             },
             Kernel::NotifyModuleMounted => {
                 ksucalls::report_module_mounted();
                 Ok(())
             }
+            Kernel::SulogFilter { command } => {
+                let (op, uid, type_mask, rate, burst) = match command {
+                    SulogFilterOp::Show => (ksu_uapi::KSU_SULOG_FILTER_OP_GET, 0, 0, 0, 0),
+                    SulogFilterOp::Reset => (ksu_uapi::KSU_SULOG_FILTER_OP_RESET, 0, 0, 0, 0),
+                    SulogFilterOp::Allow { uid } => {
+                        (ksu_uapi::KSU_SULOG_FILTER_OP_ALLOW_UID, uid, 0, 0, 0)
+                    }
+                    SulogFilterOp::Deny { uid } => {
+                        (ksu_uapi::KSU_SULOG_FILTER_OP_DENY_UID, uid, 0, 0, 0)
+                    }
+                    SulogFilterOp::Remove { uid } => {
+                        (ksu_uapi::KSU_SULOG_FILTER_OP_REMOVE_UID, uid, 0, 0, 0)
+                    }
+                    SulogFilterOp::Types { types } => (
+                        ksu_uapi::KSU_SULOG_FILTER_OP_SET_TYPES,
+                        0,
+                        sulog::parse_filter_type_mask(&types)?,
+                        0,
+                        0,
+                    ),
+                    SulogFilterOp::Rate { rate, burst } => (
+                        ksu_uapi::KSU_SULOG_FILTER_OP_SET_RATE,
+                        0,
+                        0,
+                        rate,
+                        burst.unwrap_or(rate),
+                    ),
+                };
+                let cmd = ksucalls::sulog_filter(op, uid, type_mask, rate, burst)
+                    .context("Failed to update sulog filter")?;
+                sulog::print_filter_status(&cmd);
+                Ok(())
+            }
         },
         Commands::Initrc { command } => match command {
             Initrc::Refresh => regenerate_preinit_rc(),
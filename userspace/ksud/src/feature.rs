@@ -22,6 +22,12 @@ pub enum FeatureId {
     AdbRoot = 3,
     SelinuxHide = 4,
     WebviewZygoteUmount = 5,
+    SulogCoalesce = 6,
+    SulogMaxQueued = 7,
+    SulogMaxPayload = 8,
+    SulogClock = 9,
+    KernelUmountDefer = 10,
+    KernelUmountNsCache = 11,
 }
 
 impl FeatureId {
@@ -33,6 +39,12 @@ impl FeatureId {
             3 => Some(Self::AdbRoot),
             4 => Some(Self::SelinuxHide),
             5 => Some(Self::WebviewZygoteUmount),
+            6 => Some(Self::SulogCoalesce),
+            7 => Some(Self::SulogMaxQueued),
+            8 => Some(Self::SulogMaxPayload),
+            9 => Some(Self::SulogClock),
+            10 => Some(Self::KernelUmountDefer),
+            11 => Some(Self::KernelUmountNsCache),
             _ => None,
         }
     }
@@ -45,6 +57,12 @@ impl FeatureId {
             Self::AdbRoot => "adb_root",
             Self::SelinuxHide => "selinux_hide",
             Self::WebviewZygoteUmount => "webview_zygote_umount",
+            Self::SulogCoalesce => "sulog_coalesce",
+            Self::SulogMaxQueued => "sulog_max_queued",
+            Self::SulogMaxPayload => "sulog_max_payload",
+            Self::SulogClock => "sulog_clock",
+            Self::KernelUmountDefer => "kernel_umount_defer",
+            Self::KernelUmountNsCache => "kernel_umount_ns_cache",
         }
     }
 
@@ -66,6 +84,24 @@ impl FeatureId {
             Self::WebviewZygoteUmount => {
                 "WebView Zygote Umount - unmount modules from WebView zygote and its isolated children"
             }
+            Self::SulogCoalesce => {
+                "SU Log Coalesce - fold identical consecutive sulog records into one with a repeat count"
+            }
+            Self::SulogMaxQueued => {
+                "SU Log Queue Depth - max sulog records buffered in kernel before dropping (16-65536)"
+            }
+            Self::SulogMaxPayload => {
+                "SU Log Payload Cap - max bytes per sulog record, longer argv is truncated (256-4096)"
+            }
+            Self::SulogClock => {
+                "SU Log Clock - sulog timestamp source (0=monotonic, 1=boottime, 2=monotonic fast)"
+            }
+            Self::KernelUmountDefer => {
+                "Deferred Umount - run app umounts on return to userspace instead of inside setresuid"
+            }
+            Self::KernelUmountNsCache => {
+                "Umount Subset Cache - replay only the mounts found in the zygote namespace, stale until the umount list changes"
+            }
         }
     }
 }
@@ -78,6 +114,12 @@ fn parse_feature_id(name: &str) -> Result<FeatureId> {
         "adb_root" | "3" => Ok(FeatureId::AdbRoot),
         "selinux_hide" | "4" => Ok(FeatureId::SelinuxHide),
         "webview_zygote_umount" | "5" => Ok(FeatureId::WebviewZygoteUmount),
+        "sulog_coalesce" | "6" => Ok(FeatureId::SulogCoalesce),
+        "sulog_max_queued" | "7" => Ok(FeatureId::SulogMaxQueued),
+        "sulog_max_payload" | "8" => Ok(FeatureId::SulogMaxPayload),
+        "sulog_clock" | "9" => Ok(FeatureId::SulogClock),
+        "kernel_umount_defer" | "10" => Ok(FeatureId::KernelUmountDefer),
+        "kernel_umount_ns_cache" | "11" => Ok(FeatureId::KernelUmountNsCache),
         _ => bail!("Unknown feature: {name}"),
     }
 }
@@ -325,6 +367,12 @@ pub fn list_features() {
         FeatureId::AdbRoot,
         FeatureId::SelinuxHide,
         FeatureId::WebviewZygoteUmount,
+        FeatureId::SulogCoalesce,
+        FeatureId::SulogMaxQueued,
+        FeatureId::SulogMaxPayload,
+        FeatureId::SulogClock,
+        FeatureId::KernelUmountDefer,
+        FeatureId::KernelUmountNsCache,
     ];
 
     for feature_id in &all_features {
@@ -389,6 +437,12 @@ pub fn save_config() -> Result<()> {
         FeatureId::AdbRoot,
         FeatureId::SelinuxHide,
         FeatureId::WebviewZygoteUmount,
+        FeatureId::SulogCoalesce,
+        FeatureId::SulogMaxQueued,
+        FeatureId::SulogMaxPayload,
+        FeatureId::SulogClock,
+        FeatureId::KernelUmountDefer,
+        FeatureId::KernelUmountNsCache,
     ];
 
     for feature_id in &all_features {
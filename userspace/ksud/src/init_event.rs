@@ -84,13 +84,7 @@ pub fn on_post_data_fs() -> Result<()> {
     }
 
     // load sepolicy.rule
-    if crate::module::load_sepolicy_rule().is_err() {
-        warn!("load sepolicy.rule failed");
-    }
-
-    if let Err(e) = crate::profile::apply_sepolies() {
-        warn!("apply root profile sepolicy failed: {e}");
-    }
+    load_sepolicy();
 
     // load feature config
     if is_safe_mode() {
@@ -127,6 +121,30 @@ pub fn on_post_data_fs() -> Result<()> {
     Ok(())
 }
 
+/// Module sepolicy.rule files and root profile rules, applied as one transaction
+pub fn load_sepolicy() {
+    // a failed listing must not make the cache drop entries of files it missed
+    let (mut files, mut complete) = crate::module::sepolicy_rule_files().unwrap_or_else(|e| {
+        warn!("load sepolicy.rule failed: {e}");
+        (vec![], false)
+    });
+    match crate::profile::sepolicy_files() {
+        Ok((mut profiles, listed)) => {
+            files.append(&mut profiles);
+            complete &= listed;
+        }
+        Err(e) => {
+            warn!("apply root profile sepolicy failed: {e}");
+            complete = false;
+        }
+    }
+
+    crate::sepolicy::log_avc_misses("sepolicy load");
+    if let Err(e) = crate::sepolicy::apply_files(&files, complete) {
+        warn!("apply sepolicy failed: {e}");
+    }
+}
+
 pub fn run_stage(stage: &str, block: bool) {
     utils::umask(0);
 
@@ -173,6 +191,7 @@ pub fn on_boot_completed() {
 
     ksucalls::report_boot_complete();
     info!("on_boot_completed triggered!");
+    crate::sepolicy::log_avc_misses("boot completed");
 
     run_stage("boot-completed", false);
 }
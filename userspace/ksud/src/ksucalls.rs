@@ -91,6 +91,14 @@ pub fn is_lkm() -> bool {
     get_info().flags & ksu_uapi::KSU_GET_INFO_FLAG_LKM != 0
 }
 
+pub fn sepolicy_compact_supported() -> bool {
+    get_info().flags & ksu_uapi::KSU_GET_INFO_FLAG_SEPOLICY_COMPACT != 0
+}
+
+pub fn sepolicy_sets_supported() -> bool {
+    get_info().flags & ksu_uapi::KSU_GET_INFO_FLAG_SEPOLICY_SETS != 0
+}
+
 pub const fn uapi_version() -> u32 {
     ksu_uapi::KERNEL_SU_UAPI_VERSION
 }
@@ -153,6 +161,18 @@ pub fn set_sepolicy(payload: *const u8, payload_len: u64) -> std::io::Result<i32
     ksuctl(ksu_uapi::KSU_IOCTL_SET_SEPOLICY, &raw mut ioctl_cmd)
 }
 
+/// Drive a sepolicy transaction, `payload` is only read for APPEND
+pub fn sepolicy_txn(op: u32, payload: &[u8]) -> std::io::Result<i32> {
+    let mut cmd = ksu_uapi::ksu_sepolicy_txn_cmd {
+        op,
+        _pad: 0,
+        data_len: payload.len() as u64,
+        data: payload.as_ptr() as u64,
+    };
+
+    ksuctl(ksu_uapi::KSU_IOCTL_SEPOLICY_TXN, &raw mut cmd)
+}
+
 /// Get feature value and support status from kernel
 /// Returns (value, supported)
 pub fn get_feature(feature_id: u32) -> std::io::Result<(u64, bool)> {
@@ -187,6 +207,29 @@ pub fn get_sulog_fd() -> std::io::Result<RawFd> {
     Ok(result)
 }
 
+/// Run a sulog filter op, the kernel always fills the current config and counters
+pub fn sulog_filter(
+    op: u32,
+    uid: u32,
+    type_mask: u32,
+    rate: u32,
+    burst: u32,
+) -> std::io::Result<ksu_uapi::ksu_sulog_filter_cmd> {
+    let mut cmd = ksu_uapi::ksu_sulog_filter_cmd {
+        op,
+        uid,
+        type_mask,
+        rate,
+        burst,
+        uid_rules: 0,
+        filtered_uid: 0,
+        filtered_type: 0,
+        filtered_rate: 0,
+    };
+    ksuctl(ksu_uapi::KSU_IOCTL_SULOG_FILTER, &raw mut cmd)?;
+    Ok(cmd)
+}
+
 /// Get mark status for a process (pid=0 returns total marked count)
 pub fn mark_get(pid: i32) -> std::io::Result<u32> {
     let mut cmd = ksu_uapi::ksu_manage_mark_cmd {
@@ -263,6 +306,24 @@ pub fn umount_list_add(path: &str, flags: u32) -> anyhow::Result<()> {
     Ok(())
 }
 
+/// Add many mount points with the same flags in one call
+pub fn umount_list_add_bulk(paths: &[String], flags: u32) -> anyhow::Result<()> {
+    let mut list = Vec::new();
+    for path in paths {
+        anyhow::ensure!(!path.is_empty(), "empty mount point");
+        list.extend_from_slice(std::ffi::CString::new(path.as_str())?.as_bytes_with_nul());
+    }
+    list.push(0);
+
+    let mut cmd = ksu_uapi::ksu_add_try_umount_cmd {
+        arg: list.as_ptr() as u64,
+        flags,
+        mode: ksu_uapi::KSU_UMOUNT_ADD_BULK,
+    };
+    ksuctl(ksu_uapi::KSU_IOCTL_ADD_TRY_UMOUNT, &raw mut cmd)?;
+    Ok(())
+}
+
 /// Delete mount point from umount list
 pub fn umount_list_del(path: &str) -> anyhow::Result<()> {
     let c_path = std::ffi::CString::new(path)?;
@@ -275,6 +336,62 @@ pub fn umount_list_del(path: &str) -> anyhow::Result<()> {
     Ok(())
 }
 
+/// Read the counters of the per zygote namespace umount cache
+pub fn umount_cache_stats() -> std::io::Result<ksu_uapi::ksu_umount_cache_stats> {
+    let mut stats = ksu_uapi::ksu_umount_cache_stats {
+        hits: 0,
+        misses: 0,
+        skipped: 0,
+        avoided: 0,
+    };
+    let mut cmd = ksu_uapi::ksu_add_try_umount_cmd {
+        arg: (&raw mut stats) as u64,
+        flags: 0,
+        mode: ksu_uapi::KSU_UMOUNT_GET_CACHE_STATS,
+    };
+    ksuctl(ksu_uapi::KSU_IOCTL_ADD_TRY_UMOUNT, &raw mut cmd)?;
+    Ok(stats)
+}
+
+/// Read per-entry umount counters, `None` when the kernel was built without them
+pub fn umount_entry_stats() -> std::io::Result<Option<Vec<ksu_uapi::ksu_umount_entry_stats>>> {
+    let empty = ksu_uapi::ksu_umount_entry_stats {
+        path: [0; 256],
+        flags: 0,
+        _pad: 0,
+        attempts: 0,
+        successes: 0,
+        enoent: 0,
+        einval: 0,
+        ns: 0,
+    };
+    let mut entries = Vec::new();
+    let mut stats = ksu_uapi::ksu_umount_stats_cmd {
+        count: 0,
+        filled: 0,
+        entries: 0,
+    };
+
+    // the first call only sizes the buffer
+    for _ in 0..2 {
+        entries.resize(stats.count as usize, empty);
+        stats.entries = entries.as_mut_ptr() as u64;
+        let mut cmd = ksu_uapi::ksu_add_try_umount_cmd {
+            arg: (&raw mut stats) as u64,
+            flags: 0,
+            mode: ksu_uapi::KSU_UMOUNT_GET_STATS,
+        };
+        match ksuctl(ksu_uapi::KSU_IOCTL_ADD_TRY_UMOUNT, &raw mut cmd) {
+            Err(e) if e.raw_os_error() == Some(libc::EOPNOTSUPP) => return Ok(None),
+            Err(e) => return Err(e),
+            Ok(_) => {}
+        }
+    }
+
+    entries.truncate(stats.filled as usize);
+    Ok(Some(entries))
+}
+
 /// Set current process's process group to init_group (pgid = 0)
 pub fn set_init_pgrp() -> std::io::Result<()> {
     ksuctl(
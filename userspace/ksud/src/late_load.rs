@@ -94,13 +94,7 @@ pub fn run(package_name: &String, kmi: Option<String>, allow_shell: bool) -> Res
     }
 
     // 6. Load SELinux rules
-    if crate::module::load_sepolicy_rule().is_err() {
-        warn!("load sepolicy.rule failed");
-    }
-
-    if let Err(e) = crate::profile::apply_sepolies() {
-        warn!("apply root profile sepolicy failed: {e}");
-    }
+    init_event::load_sepolicy();
 
     // 7. Initialize features
     if let Err(e) = crate::feature::init_features() {
@@ -51,6 +51,8 @@ mod su;
 #[cfg(target_os = "android")]
 mod sulog;
 #[cfg(target_os = "android")]
+mod sulog_segment;
+#[cfg(target_os = "android")]
 mod unload;
 #[cfg(target_os = "android")]
 mod utils;
@@ -3,7 +3,6 @@ use crate::utils::*;
 use crate::{
     assets, defs, ksucalls, metamodule,
     restorecon::{restore_syscon, setsyscon},
-    sepolicy,
 };
 
 use anyhow::{Context, Result, anyhow, bail, ensure};
@@ -129,16 +128,27 @@ pub enum ModuleType {
 }
 
 #[allow(clippy::needless_pass_by_value)]
-pub fn foreach_module(
+pub fn foreach_module(module_type: ModuleType, f: impl FnMut(&Path) -> Result<()>) -> Result<()> {
+    foreach_module_checked(module_type, f)?;
+    Ok(())
+}
+
+/// Like `foreach_module`, also tells whether every directory entry could be read
+fn foreach_module_checked(
     module_type: ModuleType,
     mut f: impl FnMut(&Path) -> Result<()>,
-) -> Result<()> {
+) -> Result<bool> {
     let modules_dir = Path::new(match module_type {
         ModuleType::Updated => MODULE_UPDATE_DIR,
         _ => defs::MODULE_DIR,
     });
     let dir = std::fs::read_dir(modules_dir)?;
-    for entry in dir.flatten() {
+    let mut complete = true;
+    for entry in dir {
+        let Ok(entry) = entry else {
+            complete = false;
+            continue;
+        };
         let path = entry.path();
         if !path.is_dir() {
             warn!("{} is not a directory, skip", path.display());
@@ -157,28 +167,25 @@ pub fn foreach_module(
         f(&path)?;
     }
 
-    Ok(())
+    Ok(complete)
 }
 
 fn foreach_active_module(f: impl FnMut(&Path) -> Result<()>) -> Result<()> {
     foreach_module(Active, f)
 }
 
-pub fn load_sepolicy_rule() -> Result<()> {
-    foreach_active_module(|path| {
+/// Active module rule files, and whether every module entry could be read
+pub fn sepolicy_rule_files() -> Result<(Vec<PathBuf>, bool)> {
+    let mut files = vec![];
+    let complete = foreach_module_checked(Active, |path| {
         let rule_file = path.join("sepolicy.rule");
-        if !rule_file.exists() {
-            return Ok(());
-        }
-        info!("load policy: {}", rule_file.display());
-
-        if sepolicy::apply_file(&rule_file).is_err() {
-            warn!("Failed to load sepolicy.rule for {}", rule_file.display());
+        if rule_file.exists() {
+            files.push(rule_file);
         }
         Ok(())
     })?;
 
-    Ok(())
+    Ok((files, complete))
 }
 
 pub fn exec_script<T: AsRef<Path>>(path: T, wait: bool) -> Result<()> {
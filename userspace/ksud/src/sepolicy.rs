@@ -1,3 +1,4 @@
+use crate::defs;
 use anyhow::{Context, Result, bail};
 use derive_new::new;
 use nom::{
@@ -7,7 +8,12 @@ use nom::{
     character::complete::{space0, space1},
     combinator::map,
 };
-use std::{path::Path, vec};
+use std::{
+    collections::{HashMap, HashSet},
+    path::{Path, PathBuf},
+    time::Instant,
+    vec,
+};
 
 type SeObject<'a> = Vec<&'a str>;
 
@@ -371,14 +377,39 @@ where
     Ok(statements)
 }
 
-#[derive(Debug, Default)]
+#[derive(Debug, Default, Clone)]
 enum PolicyObject {
     All,
     One(Vec<u8>),
+    Set(Vec<Vec<u8>>),
     #[default]
     None,
 }
 
+impl PolicyObject {
+    /// `{ a b c }` stays one set-valued object instead of three statements
+    fn from_objs(objs: &[&str]) -> Result<Self> {
+        if let [obj] = objs {
+            return Self::try_from(*obj);
+        }
+        let mut set = Vec::with_capacity(objs.len());
+        for &obj in objs {
+            match Self::try_from(obj)? {
+                Self::One(value) => set.push(value),
+                _ => bail!("{obj} cannot be part of a set"),
+            }
+        }
+        Ok(Self::Set(set))
+    }
+
+    const fn len(&self) -> usize {
+        match self {
+            Self::Set(set) => set.len(),
+            _ => 1,
+        }
+    }
+}
+
 impl TryFrom<&str> for PolicyObject {
     type Error = anyhow::Error;
     fn try_from(s: &str) -> Result<Self> {
@@ -391,11 +422,12 @@ impl TryFrom<&str> for PolicyObject {
 }
 
 /// atomic statement, such as: allow domain1 domain2:file1 read;
-/// normal statement would be expand to atomic statement, for example:
-/// allow domain1 domain2:file1 { read write }; would be expand to two atomic statement
-/// allow domain1 domain2:file1 read;allow domain1 domain2:file1 write;
+/// brace sets are kept as set-valued objects, for example:
+/// allow domain1 domain2:file1 { read write }; is one statement, `expand_sets`
+/// turns it into allow domain1 domain2:file1 read;allow domain1 domain2:file1 write;
+/// for kernels that cannot take sets.
 #[allow(clippy::too_many_arguments)]
-#[derive(Debug, new)]
+#[derive(Debug, Clone, new)]
 struct AtomicStatement {
     cmd: u32,
     subcmd: u32,
@@ -408,10 +440,80 @@ struct AtomicStatement {
     sepol7: PolicyObject,
 }
 
+impl AtomicStatement {
+    const fn args(&self) -> [&PolicyObject; 7] {
+        [
+            &self.sepol1,
+            &self.sepol2,
+            &self.sepol3,
+            &self.sepol4,
+            &self.sepol5,
+            &self.sepol6,
+            &self.sepol7,
+        ]
+    }
+
+    /// how many rules the kernel applies for this statement
+    fn combinations(&self) -> usize {
+        let argc = cmd_expected_argc(self.cmd).unwrap_or(0);
+        self.args()
+            .into_iter()
+            .take(argc)
+            .map(PolicyObject::len)
+            .product()
+    }
+
+    /// one statement per combination of the set members, last argument varies fastest
+    fn expand_into(&self, out: &mut Vec<Self>) {
+        let args = self.args();
+        if !args
+            .iter()
+            .any(|object| matches!(object, PolicyObject::Set(_)))
+        {
+            out.push(self.clone());
+            return;
+        }
+        if self.combinations() == 0 {
+            return;
+        }
+
+        let mut pos = [0usize; 7];
+        loop {
+            let pick = |i: usize| match args[i] {
+                PolicyObject::Set(set) => PolicyObject::One(set[pos[i]].clone()),
+                object => object.clone(),
+            };
+            out.push(Self::new(
+                self.cmd,
+                self.subcmd,
+                pick(0),
+                pick(1),
+                pick(2),
+                pick(3),
+                pick(4),
+                pick(5),
+                pick(6),
+            ));
+
+            let mut i = args.len();
+            loop {
+                if i == 0 {
+                    return;
+                }
+                i -= 1;
+                if pos[i] + 1 < args[i].len() {
+                    pos[i] += 1;
+                    break;
+                }
+                pos[i] = 0;
+            }
+        }
+    }
+}
+
 impl<'a> TryFrom<&'a NormalPerm<'a>> for Vec<AtomicStatement> {
     type Error = anyhow::Error;
     fn try_from(perm: &'a NormalPerm<'a>) -> Result<Self> {
-        let mut result = vec![];
         let subcmd = match perm.op {
             "allow" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_ALLOW,
             "deny" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DENY,
@@ -419,129 +521,96 @@ impl<'a> TryFrom<&'a NormalPerm<'a>> for Vec<AtomicStatement> {
             "dontaudit" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_NORMAL_PERM_DONTAUDIT,
             _ => 0,
         };
-        for &s in &perm.source {
-            for &t in &perm.target {
-                for &c in &perm.class {
-                    for &p in &perm.perm {
-                        result.push(AtomicStatement {
-                            cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_NORMAL_PERM,
-                            subcmd,
-                            sepol1: s.try_into()?,
-                            sepol2: t.try_into()?,
-                            sepol3: c.try_into()?,
-                            sepol4: p.try_into()?,
-                            sepol5: PolicyObject::None,
-                            sepol6: PolicyObject::None,
-                            sepol7: PolicyObject::None,
-                        });
-                    }
-                }
-            }
-        }
-        Ok(result)
+        Ok(vec![AtomicStatement {
+            cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_NORMAL_PERM,
+            subcmd,
+            sepol1: PolicyObject::from_objs(&perm.source)?,
+            sepol2: PolicyObject::from_objs(&perm.target)?,
+            sepol3: PolicyObject::from_objs(&perm.class)?,
+            sepol4: PolicyObject::from_objs(&perm.perm)?,
+            sepol5: PolicyObject::None,
+            sepol6: PolicyObject::None,
+            sepol7: PolicyObject::None,
+        }])
     }
 }
 
 impl<'a> TryFrom<&'a XPerm<'a>> for Vec<AtomicStatement> {
     type Error = anyhow::Error;
     fn try_from(perm: &'a XPerm<'a>) -> Result<Self> {
-        let mut result = vec![];
         let subcmd = match perm.op {
             "allowxperm" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_XPERM_ALLOW,
             "auditallowxperm" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_XPERM_AUDITALLOW,
             "dontauditxperm" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_XPERM_DONTAUDIT,
             _ => 0,
         };
-        for &s in &perm.source {
-            for &t in &perm.target {
-                for &c in &perm.class {
-                    for &r in &perm.perm_set {
-                        result.push(AtomicStatement {
-                            cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_XPERM,
-                            subcmd,
-                            sepol1: s.try_into()?,
-                            sepol2: t.try_into()?,
-                            sepol3: c.try_into()?,
-                            sepol4: perm.operation.try_into()?,
-                            sepol5: r.try_into()?,
-                            sepol6: PolicyObject::None,
-                            sepol7: PolicyObject::None,
-                        });
-                    }
-                }
-            }
-        }
-        Ok(result)
+        Ok(vec![AtomicStatement {
+            cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_XPERM,
+            subcmd,
+            sepol1: PolicyObject::from_objs(&perm.source)?,
+            sepol2: PolicyObject::from_objs(&perm.target)?,
+            sepol3: PolicyObject::from_objs(&perm.class)?,
+            sepol4: perm.operation.try_into()?,
+            sepol5: PolicyObject::from_objs(&perm.perm_set)?,
+            sepol6: PolicyObject::None,
+            sepol7: PolicyObject::None,
+        }])
     }
 }
 
 impl<'a> TryFrom<&'a TypeState<'a>> for Vec<AtomicStatement> {
     type Error = anyhow::Error;
     fn try_from(perm: &'a TypeState<'a>) -> Result<Self> {
-        let mut result = vec![];
         let subcmd = match perm.op {
             "permissive" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_TYPE_STATE_PERMISSIVE,
             "enforce" => crate::ksu_uapi::KSU_SEPOLICY_SUBCMD_TYPE_STATE_ENFORCE,
             _ => 0,
         };
-        for &t in &perm.stype {
-            result.push(AtomicStatement {
-                cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_TYPE_STATE,
-                subcmd,
-                sepol1: t.try_into()?,
-                sepol2: PolicyObject::None,
-                sepol3: PolicyObject::None,
-                sepol4: PolicyObject::None,
-                sepol5: PolicyObject::None,
-                sepol6: PolicyObject::None,
-                sepol7: PolicyObject::None,
-            });
-        }
-        Ok(result)
+        Ok(vec![AtomicStatement {
+            cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_TYPE_STATE,
+            subcmd,
+            sepol1: PolicyObject::from_objs(&perm.stype)?,
+            sepol2: PolicyObject::None,
+            sepol3: PolicyObject::None,
+            sepol4: PolicyObject::None,
+            sepol5: PolicyObject::None,
+            sepol6: PolicyObject::None,
+            sepol7: PolicyObject::None,
+        }])
     }
 }
 
 impl<'a> TryFrom<&'a Type<'a>> for Vec<AtomicStatement> {
     type Error = anyhow::Error;
     fn try_from(perm: &'a Type<'a>) -> Result<Self> {
-        let mut result = vec![];
-        for &attr in &perm.attrs {
-            result.push(AtomicStatement {
-                cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_TYPE,
-                subcmd: 0,
-                sepol1: perm.name.try_into()?,
-                sepol2: attr.try_into()?,
-                sepol3: PolicyObject::None,
-                sepol4: PolicyObject::None,
-                sepol5: PolicyObject::None,
-                sepol6: PolicyObject::None,
-                sepol7: PolicyObject::None,
-            });
-        }
-        Ok(result)
+        Ok(vec![AtomicStatement {
+            cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_TYPE,
+            subcmd: 0,
+            sepol1: perm.name.try_into()?,
+            sepol2: PolicyObject::from_objs(&perm.attrs)?,
+            sepol3: PolicyObject::None,
+            sepol4: PolicyObject::None,
+            sepol5: PolicyObject::None,
+            sepol6: PolicyObject::None,
+            sepol7: PolicyObject::None,
+        }])
     }
 }
 
 impl<'a> TryFrom<&'a TypeAttr<'a>> for Vec<AtomicStatement> {
     type Error = anyhow::Error;
     fn try_from(perm: &'a TypeAttr<'a>) -> Result<Self> {
-        let mut result = vec![];
-        for &t in &perm.stype {
-            for &attr in &perm.sattr {
-                result.push(AtomicStatement {
-                    cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_TYPE_ATTR,
-                    subcmd: 0,
-                    sepol1: t.try_into()?,
-                    sepol2: attr.try_into()?,
-                    sepol3: PolicyObject::None,
-                    sepol4: PolicyObject::None,
-                    sepol5: PolicyObject::None,
-                    sepol6: PolicyObject::None,
-                    sepol7: PolicyObject::None,
-                });
-            }
-        }
-        Ok(result)
+        Ok(vec![AtomicStatement {
+            cmd: crate::ksu_uapi::KSU_SEPOLICY_CMD_TYPE_ATTR,
+            subcmd: 0,
+            sepol1: PolicyObject::from_objs(&perm.stype)?,
+            sepol2: PolicyObject::from_objs(&perm.sattr)?,
+            sepol3: PolicyObject::None,
+            sepol4: PolicyObject::None,
+            sepol5: PolicyObject::None,
+            sepol6: PolicyObject::None,
+            sepol7: PolicyObject::None,
+        }])
     }
 }
 
@@ -666,6 +735,7 @@ fn encode_policy_object(payload: &mut Vec<u8>, object: &PolicyObject) -> Result<
     let bytes = match object {
         PolicyObject::None | PolicyObject::All => &[][..],
         PolicyObject::One(value) => value.as_slice(),
+        PolicyObject::Set(_) => bail!("set-valued policy object needs expanding first"),
     };
 
     let len = u32::try_from(bytes.len()).context("policy object too long to encode")?;
@@ -683,24 +753,14 @@ fn append_atomic_statement(payload: &mut Vec<u8>, statement: &AtomicStatement) -
     payload.extend_from_slice(&statement.cmd.to_ne_bytes());
     payload.extend_from_slice(&statement.subcmd.to_ne_bytes());
 
-    let args = [
-        &statement.sepol1,
-        &statement.sepol2,
-        &statement.sepol3,
-        &statement.sepol4,
-        &statement.sepol5,
-        &statement.sepol6,
-        &statement.sepol7,
-    ];
-
-    for object in args.iter().take(expected_argc) {
+    for object in statement.args().into_iter().take(expected_argc) {
         encode_policy_object(payload, object)?;
     }
 
     Ok(())
 }
 
-fn serialize_atomic_statements(statements: &[AtomicStatement]) -> Result<Vec<u8>> {
+fn serialize_inline(statements: &[AtomicStatement]) -> Result<Vec<u8>> {
     let mut payload = vec![];
     for statement in statements {
         append_atomic_statement(&mut payload, statement)?;
@@ -708,33 +768,217 @@ fn serialize_atomic_statements(statements: &[AtomicStatement]) -> Result<Vec<u8>
     Ok(payload)
 }
 
+#[derive(Clone, Copy)]
+enum CompactRef {
+    All,
+    Str(u32),
+    Set(u32),
+}
+
+/// String and set tables of a compact payload, refs are 1-based
+#[derive(Default)]
+struct CompactTables<'a> {
+    index: HashMap<&'a [u8], u32>,
+    strings: Vec<&'a [u8]>,
+    set_index: HashMap<Vec<u32>, u32>,
+    sets: Vec<Vec<u32>>,
+}
+
+impl<'a> CompactTables<'a> {
+    fn intern(&mut self, value: &'a [u8]) -> Result<u32> {
+        if let Some(&reference) = self.index.get(value) {
+            return Ok(reference);
+        }
+        self.strings.push(value);
+        let reference = u32::try_from(self.strings.len()).context("too many policy strings")?;
+        self.index.insert(value, reference);
+        Ok(reference)
+    }
+
+    fn intern_set(&mut self, values: &'a [Vec<u8>]) -> Result<u32> {
+        let members = values
+            .iter()
+            .map(|value| self.intern(value))
+            .collect::<Result<Vec<_>>>()?;
+        if let Some(&reference) = self.set_index.get(&members) {
+            return Ok(reference);
+        }
+        self.sets.push(members.clone());
+        let reference = u32::try_from(self.sets.len()).context("too many policy sets")?;
+        self.set_index.insert(members, reference);
+        Ok(reference)
+    }
+
+    fn reference(&mut self, object: &'a PolicyObject) -> Result<CompactRef> {
+        Ok(match object {
+            // an empty name means ALL in the inline format too
+            PolicyObject::One(value) if !value.is_empty() => CompactRef::Str(self.intern(value)?),
+            PolicyObject::Set(values) => CompactRef::Set(self.intern_set(values)?),
+            _ => CompactRef::All,
+        })
+    }
+}
+
+/// Compact payload, see `ksu_sepolicy_compact_hdr`: every distinct name goes
+/// into the string table once and statements refer to it by index, runs of
+/// statements with the same cmd/subcmd share one group header. Set-valued
+/// objects go into the set table, callers expand them for kernels without it.
+fn serialize_compact(statements: &[AtomicStatement]) -> Result<Vec<u8>> {
+    let mut tables = CompactTables::default();
+    // cmd, subcmd, argc, count
+    let mut groups: Vec<(u32, u32, usize, u32)> = vec![];
+    let mut refs = Vec::with_capacity(statements.len() * 4);
+
+    for statement in statements {
+        let expected_argc = cmd_expected_argc(statement.cmd)
+            .ok_or_else(|| anyhow::anyhow!("unknown sepolicy cmd {}", statement.cmd))?;
+
+        match groups.last_mut() {
+            Some((cmd, subcmd, _, count))
+                if *cmd == statement.cmd && *subcmd == statement.subcmd =>
+            {
+                *count += 1;
+            }
+            _ => groups.push((statement.cmd, statement.subcmd, expected_argc, 1)),
+        }
+
+        for object in statement.args().into_iter().take(expected_argc) {
+            refs.push(tables.reference(object)?);
+        }
+    }
+
+    let CompactTables { strings, sets, .. } = tables;
+    let strings_len: usize = strings.iter().map(|string| string.len() + 1).sum();
+    let set_refs: usize = sets.iter().map(|members| members.len() + 1).sum();
+    let nstrings = u32::try_from(strings.len()).context("too many policy strings")?;
+
+    // set member counts share the ref width
+    let widest = sets.iter().map(Vec::len).max().unwrap_or(0);
+    let ref16 = u16::try_from(strings.len() + sets.len()).is_ok() && u16::try_from(widest).is_ok();
+    let ref_size = if ref16 {
+        size_of::<u16>()
+    } else {
+        size_of::<u32>()
+    };
+    let mut flags = if ref16 {
+        crate::ksu_uapi::KSU_SEPOLICY_COMPACT_REF16
+    } else {
+        0
+    };
+    if !sets.is_empty() {
+        flags |= crate::ksu_uapi::KSU_SEPOLICY_COMPACT_SETS;
+    }
+
+    let mut payload = Vec::with_capacity(
+        size_of::<crate::ksu_uapi::ksu_sepolicy_compact_hdr>()
+            + strings_len
+            + size_of::<crate::ksu_uapi::ksu_sepolicy_compact_sets>()
+            + set_refs * ref_size
+            + groups.len() * size_of::<crate::ksu_uapi::ksu_sepolicy_compact_group>()
+            + refs.len() * ref_size,
+    );
+    let put_ref = |payload: &mut Vec<u8>, reference: usize| -> Result<()> {
+        if ref16 {
+            let reference = u16::try_from(reference).context("policy string ref overflow")?;
+            payload.extend_from_slice(&reference.to_ne_bytes());
+        } else {
+            let reference = u32::try_from(reference).context("policy string ref overflow")?;
+            payload.extend_from_slice(&reference.to_ne_bytes());
+        }
+        Ok(())
+    };
+
+    payload.extend_from_slice(&crate::ksu_uapi::KSU_SEPOLICY_COMPACT_MAGIC.to_ne_bytes());
+    payload.extend_from_slice(&flags.to_ne_bytes());
+    payload.extend_from_slice(&nstrings.to_ne_bytes());
+    payload.extend_from_slice(
+        &u32::try_from(strings_len)
+            .context("policy strings too long")?
+            .to_ne_bytes(),
+    );
+    for string in &strings {
+        payload.extend_from_slice(string);
+        payload.push(0);
+    }
+
+    if !sets.is_empty() {
+        payload.extend_from_slice(
+            &u32::try_from(sets.len())
+                .context("too many policy sets")?
+                .to_ne_bytes(),
+        );
+        payload.extend_from_slice(
+            &u32::try_from(set_refs)
+                .context("policy sets too large")?
+                .to_ne_bytes(),
+        );
+        for members in &sets {
+            put_ref(&mut payload, members.len())?;
+            for &member in members {
+                put_ref(&mut payload, member as usize)?;
+            }
+        }
+    }
+
+    let mut refs = refs.into_iter();
+    for (cmd, subcmd, argc, count) in groups {
+        payload.extend_from_slice(&cmd.to_ne_bytes());
+        payload.extend_from_slice(&subcmd.to_ne_bytes());
+        payload.extend_from_slice(&count.to_ne_bytes());
+
+        for reference in refs.by_ref().take(count as usize * argc) {
+            let reference = match reference {
+                CompactRef::All => 0,
+                CompactRef::Str(string) => string as usize,
+                CompactRef::Set(set) => strings.len() + set as usize,
+            };
+            put_ref(&mut payload, reference)?;
+        }
+    }
+
+    Ok(payload)
+}
+
+fn expand_sets(statements: &[AtomicStatement]) -> Vec<AtomicStatement> {
+    let mut expanded = Vec::with_capacity(statements.len());
+    for statement in statements {
+        statement.expand_into(&mut expanded);
+    }
+    expanded
+}
+
+/// Payload in the best format this kernel takes, and the rule count it applies to.
+fn serialize_atomic_statements(statements: &[AtomicStatement]) -> Result<(Vec<u8>, usize)> {
+    let count = statements.iter().map(AtomicStatement::combinations).sum();
+    let payload = if crate::ksucalls::sepolicy_sets_supported() {
+        serialize_compact(statements)?
+    } else if crate::ksucalls::sepolicy_compact_supported() {
+        serialize_compact(&expand_sets(statements))?
+    } else {
+        serialize_inline(&expand_sets(statements))?
+    };
+    Ok((payload, count))
+}
+
 fn flatten_atomic_statements<'a>(
     statements: &'a [PolicyStatement<'a>],
 ) -> Result<Vec<AtomicStatement>> {
     let mut policies = vec![];
     for statement in statements {
-        let mut expanded: Vec<AtomicStatement> = statement.try_into()?;
-        policies.append(&mut expanded);
+        let mut converted: Vec<AtomicStatement> = statement.try_into()?;
+        policies.append(&mut converted);
     }
     Ok(policies)
 }
 
-fn apply_rules_batch<'a>(statements: &'a [PolicyStatement<'a>], strict: bool) -> Result<()> {
-    let policies = flatten_atomic_statements(statements)?;
-    if policies.is_empty() {
-        return Ok(());
-    }
-
-    let payload = serialize_atomic_statements(&policies)?;
-
-    match crate::ksucalls::set_sepolicy(payload.as_ptr(), payload.len() as u64) {
+fn check_applied(result: std::io::Result<i32>, expected: usize, strict: bool) -> Result<()> {
+    match result {
         Ok(applied_count) => {
             let applied_count = usize::try_from(applied_count)
                 .context("kernel returned negative sepolicy applied count")?;
-            if applied_count < policies.len() {
+            if applied_count < expected {
                 let err = anyhow::anyhow!(
-                    "apply sepolicy batch partially succeeded: {applied_count}/{}",
-                    policies.len()
+                    "apply sepolicy batch partially succeeded: {applied_count}/{expected}"
                 );
                 if strict {
                     return Err(err);
@@ -753,6 +997,234 @@ fn apply_rules_batch<'a>(statements: &'a [PolicyStatement<'a>], strict: bool) ->
     Ok(())
 }
 
+fn apply_rules_batch<'a>(statements: &'a [PolicyStatement<'a>], strict: bool) -> Result<()> {
+    let policies = flatten_atomic_statements(statements)?;
+    if policies.is_empty() {
+        return Ok(());
+    }
+
+    let (payload, count) = serialize_atomic_statements(&policies)?;
+
+    check_applied(
+        crate::ksucalls::set_sepolicy(payload.as_ptr(), payload.len() as u64),
+        count,
+        strict,
+    )
+}
+
+const POLICY_VERSION: &str = "/sys/fs/selinux/policyvers";
+
+/// Compiled payloads are only valid for the kernel payload formats and
+/// the serializer they were made with, so those go into every key.
+/// The same for all files of a boot, so it is read once per `apply_files`.
+fn compile_cache_prefix() -> String {
+    let info = crate::ksucalls::get_info();
+    let policy_version = std::fs::read_to_string(POLICY_VERSION).unwrap_or_default();
+    format!(
+        "{}\0{}\0{}\0{}\0",
+        defs::VERSION_CODE,
+        info.version,
+        info.flags,
+        policy_version.trim(),
+    )
+}
+
+fn compile_cache_key(prefix: &str, input: &str) -> String {
+    sha256::digest(format!("{prefix}{input}"))
+}
+
+fn compile_cache_path(key: &str) -> PathBuf {
+    Path::new(defs::SEPOLICY_CACHE_DIR).join(format!("{key}.bin"))
+}
+
+/// Cache entry: the rule count as a little endian u64, then the payload
+fn encode_compiled(payload: &[u8], count: usize) -> Vec<u8> {
+    let mut entry = Vec::with_capacity(8 + payload.len());
+    entry.extend_from_slice(&(count as u64).to_le_bytes());
+    entry.extend_from_slice(payload);
+    entry
+}
+
+fn decode_compiled(mut entry: Vec<u8>) -> Option<(Vec<u8>, usize)> {
+    let count = u64::from_le_bytes(entry.get(..8)?.try_into().ok()?);
+    entry.drain(..8);
+    Some((entry, usize::try_from(count).ok()?))
+}
+
+fn store_compiled(key: &str, payload: &[u8], count: usize) -> Result<()> {
+    crate::utils::ensure_dir_exists(defs::SEPOLICY_CACHE_DIR)?;
+    let path = compile_cache_path(key);
+    let tmp = path.with_extension("tmp");
+    std::fs::write(&tmp, encode_compiled(payload, count))?;
+    std::fs::rename(&tmp, &path)?;
+    Ok(())
+}
+
+/// Drop cache entries no current rule file maps to
+fn prune_compile_cache(keys: &HashSet<String>) {
+    let Ok(entries) = std::fs::read_dir(defs::SEPOLICY_CACHE_DIR) else {
+        return;
+    };
+    for entry in entries.flatten() {
+        let path = entry.path();
+        let used = path
+            .file_stem()
+            .and_then(|stem| stem.to_str())
+            .is_some_and(|stem| keys.contains(stem));
+        if !used && let Err(e) = std::fs::remove_file(&path) {
+            log::warn!("Failed to remove {}: {e}", path.display());
+        }
+    }
+}
+
+struct CompiledFile {
+    key: String,
+    payload: Vec<u8>,
+    count: usize,
+    cached: bool,
+}
+
+/// Payload and rule count of a rule file, from the cache when its content,
+/// ksud and the kernel are unchanged since the last boot.
+fn compile_file(prefix: &str, path: &Path) -> Result<CompiledFile> {
+    let input = std::fs::read_to_string(path)?;
+    let key = compile_cache_key(prefix, &input);
+    if let Some((payload, count)) = std::fs::read(compile_cache_path(&key))
+        .ok()
+        .and_then(decode_compiled)
+    {
+        return Ok(CompiledFile {
+            key,
+            payload,
+            count,
+            cached: true,
+        });
+    }
+
+    let statements = parse_sepolicy(input.trim(), false)?;
+    let policies = flatten_atomic_statements(&statements)?;
+    let (payload, count) = serialize_atomic_statements(&policies)?;
+    if let Err(e) = store_compiled(&key, &payload, count) {
+        log::warn!("Failed to cache sepolicy {}: {e}", path.display());
+    }
+    Ok(CompiledFile {
+        key,
+        payload,
+        count,
+        cached: false,
+    })
+}
+
+/// Apply many rule files with one policy copy, swap and AVC reset.
+/// Kernels without sepolicy transactions get one call per file.
+/// When `complete` says `paths` is every rule file in use and all of them
+/// could be read, cached payloads of other files are dropped.
+pub fn apply_files<P: AsRef<Path>>(paths: &[P], complete: bool) -> Result<()> {
+    let start = Instant::now();
+    let prefix = compile_cache_prefix();
+    let mut prune = complete;
+    let mut keys = HashSet::with_capacity(paths.len());
+    let mut cached = 0;
+    let mut compiled = Vec::with_capacity(paths.len());
+    for path in paths {
+        let path = path.as_ref();
+        match compile_file(&prefix, path) {
+            Ok(file) => {
+                cached += usize::from(file.cached);
+                keys.insert(file.key);
+                if file.count > 0 {
+                    compiled.push((path, file.payload, file.count));
+                }
+            }
+            Err(e) => {
+                // its entry may still be good, keep it for the next boot
+                prune = false;
+                log::warn!("Failed to load sepolicy {}: {e}", path.display());
+            }
+        }
+    }
+    if prune {
+        prune_compile_cache(&keys);
+    }
+    let compile_time = start.elapsed();
+
+    let start = Instant::now();
+    let result = submit_compiled(&compiled);
+    log::info!(
+        "sepolicy: compiled {} files ({cached} cached) in {compile_time:?}, applied in {:?}",
+        paths.len(),
+        start.elapsed()
+    );
+    result
+}
+
+fn submit_compiled(compiled: &[(&Path, Vec<u8>, usize)]) -> Result<()> {
+    use crate::ksu_uapi::{
+        KSU_SEPOLICY_TXN_APPEND, KSU_SEPOLICY_TXN_BEGIN, KSU_SEPOLICY_TXN_COMMIT,
+    };
+    use crate::ksucalls::sepolicy_txn;
+
+    if compiled.is_empty() {
+        return Ok(());
+    }
+
+    match sepolicy_txn(KSU_SEPOLICY_TXN_BEGIN, &[]) {
+        Ok(_) => {
+            for (path, payload, count) in compiled {
+                log::info!("load policy: {}", path.display());
+                check_applied(
+                    sepolicy_txn(KSU_SEPOLICY_TXN_APPEND, payload),
+                    *count,
+                    false,
+                )?;
+            }
+            // APPEND only checks and queues, rules that fail to apply show up here.
+            // A failed commit is not retried per file: part of the queue may be
+            // live already, and every file would be another policy update.
+            let total = compiled.iter().map(|(_, _, count)| count).sum();
+            return check_applied(sepolicy_txn(KSU_SEPOLICY_TXN_COMMIT, &[]), total, false);
+        }
+        Err(e) => log::info!("sepolicy transaction unavailable: {e}"),
+    }
+
+    for (path, payload, count) in compiled {
+        log::info!("load policy: {}", path.display());
+        check_applied(
+            crate::ksucalls::set_sepolicy(payload.as_ptr(), payload.len() as u64),
+            *count,
+            false,
+        )?;
+    }
+
+    Ok(())
+}
+
+const AVC_CACHE_STATS: &str = "/sys/fs/selinux/avc/cache_stats";
+
+/// Sum of the per-cpu `misses` column of selinuxfs `cache_stats`
+fn parse_avc_misses(stats: &str) -> Option<u64> {
+    let mut lines = stats.lines();
+    let column = lines
+        .next()?
+        .split_whitespace()
+        .position(|name| name == "misses")?;
+    lines
+        .filter_map(|line| line.split_whitespace().nth(column)?.parse::<u64>().ok())
+        .reduce(|total, misses| total + misses)
+}
+
+/// Log AVC misses so far, to compare boots with and without AVC flushes
+pub fn log_avc_misses(stage: &str) {
+    match std::fs::read_to_string(AVC_CACHE_STATS)
+        .ok()
+        .as_deref()
+        .and_then(parse_avc_misses)
+    {
+        Some(misses) => log::info!("avc misses at {stage}: {misses}"),
+        None => log::debug!("avc cache_stats unavailable at {stage}"),
+    }
+}
+
 pub fn live_patch(policy: &str) -> Result<()> {
     let result = parse_sepolicy(policy.trim(), false)?;
     for statement in &result {
@@ -777,3 +1249,269 @@ pub fn check_rule(policy: &str) -> Result<()> {
     parse_sepolicy(policy.trim(), true)?;
     Ok(())
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // cmd, subcmd and the arguments, None is ALL
+    type Decoded = Vec<(u32, u32, Vec<Option<Vec<u8>>>)>;
+
+    fn read_u32(payload: &[u8], pos: &mut usize) -> u32 {
+        let value = u32::from_ne_bytes(payload[*pos..*pos + 4].try_into().unwrap());
+        *pos += 4;
+        value
+    }
+
+    fn expected(statements: &[AtomicStatement]) -> Decoded {
+        statements
+            .iter()
+            .map(|statement| {
+                let expected_argc = cmd_expected_argc(statement.cmd).unwrap();
+                let args = statement
+                    .args()
+                    .into_iter()
+                    .take(expected_argc)
+                    .map(|object| match object {
+                        PolicyObject::One(value) if !value.is_empty() => Some(value.clone()),
+                        PolicyObject::Set(_) => panic!("expand sets first"),
+                        _ => None,
+                    })
+                    .collect();
+                (statement.cmd, statement.subcmd, args)
+            })
+            .collect()
+    }
+
+    fn decode_inline(payload: &[u8]) -> Decoded {
+        let mut decoded = vec![];
+        let mut pos = 0;
+        while pos < payload.len() {
+            let cmd = read_u32(payload, &mut pos);
+            let subcmd = read_u32(payload, &mut pos);
+            let mut args = vec![];
+            for _ in 0..cmd_expected_argc(cmd).unwrap() {
+                let len = read_u32(payload, &mut pos) as usize;
+                let value = payload[pos..pos + len].to_vec();
+                assert_eq!(payload[pos + len], 0);
+                pos += len + 1;
+                args.push((len != 0).then_some(value));
+            }
+            decoded.push((cmd, subcmd, args));
+        }
+        decoded
+    }
+
+    // the bounds the kernel checks a set table against before filling its members
+    fn set_table_fits(nsets: usize, refs: &[usize]) -> bool {
+        let Some(capacity) = refs.len().checked_sub(nsets) else {
+            return false;
+        };
+        let mut filled = 0;
+        let mut pos = 0;
+        for _ in 0..nsets {
+            let Some(&count) = refs.get(pos) else {
+                return false;
+            };
+            if count == 0 || count > capacity - filled {
+                return false;
+            }
+            filled += count;
+            pos += 1 + count;
+        }
+        pos == refs.len()
+    }
+
+    fn decode_compact(payload: &[u8]) -> Decoded {
+        let mut pos = 0;
+        assert_eq!(
+            read_u32(payload, &mut pos),
+            crate::ksu_uapi::KSU_SEPOLICY_COMPACT_MAGIC
+        );
+        let flags = read_u32(payload, &mut pos);
+        let nstrings = read_u32(payload, &mut pos) as usize;
+        let strings_len = read_u32(payload, &mut pos) as usize;
+
+        let table = &payload[pos..pos + strings_len];
+        let strings: Vec<&[u8]> = table.split(|&b| b == 0).take(nstrings).collect();
+        assert_eq!(strings.len(), nstrings);
+        assert!(strings.iter().all(|s| !s.is_empty()));
+        pos += strings_len;
+
+        let ref16 = flags & crate::ksu_uapi::KSU_SEPOLICY_COMPACT_REF16 != 0;
+        let read_ref = |pos: &mut usize| {
+            if ref16 {
+                let value = u16::from_ne_bytes(payload[*pos..*pos + 2].try_into().unwrap());
+                *pos += 2;
+                value as usize
+            } else {
+                read_u32(payload, pos) as usize
+            }
+        };
+
+        let mut sets: Vec<Vec<Option<Vec<u8>>>> = vec![];
+        if flags & crate::ksu_uapi::KSU_SEPOLICY_COMPACT_SETS != 0 {
+            let nsets = read_u32(payload, &mut pos) as usize;
+            let nrefs = read_u32(payload, &mut pos) as usize;
+            let refs: Vec<usize> = (0..nrefs).map(|_| read_ref(&mut pos)).collect();
+            assert!(set_table_fits(nsets, &refs));
+            let mut refs = refs.into_iter();
+            for _ in 0..nsets {
+                let count = refs.next().unwrap();
+                let members = refs
+                    .by_ref()
+                    .take(count)
+                    .map(|reference| Some(strings[reference - 1].to_vec()))
+                    .collect();
+                sets.push(members);
+            }
+        }
+
+        let mut decoded = vec![];
+        while pos < payload.len() {
+            let cmd = read_u32(payload, &mut pos);
+            let subcmd = read_u32(payload, &mut pos);
+            let count = read_u32(payload, &mut pos);
+            for _ in 0..count {
+                // every combination, the last argument varies fastest
+                let mut combinations = vec![vec![]];
+                for _ in 0..cmd_expected_argc(cmd).unwrap() {
+                    let reference = read_ref(&mut pos);
+                    let choices = match reference {
+                        0 => vec![None],
+                        r if r <= nstrings => vec![Some(strings[r - 1].to_vec())],
+                        r => sets[r - nstrings - 1].clone(),
+                    };
+                    combinations = combinations
+                        .into_iter()
+                        .flat_map(|prefix: Vec<Option<Vec<u8>>>| {
+                            choices.iter().map(move |choice| {
+                                let mut args = prefix.clone();
+                                args.push(choice.clone());
+                                args
+                            })
+                        })
+                        .collect();
+                }
+                for args in combinations {
+                    decoded.push((cmd, subcmd, args));
+                }
+            }
+        }
+        decoded
+    }
+
+    #[test]
+    fn compact_round_trip() {
+        let policy = "
+            type ksu_file file_type
+            typeattribute ksu_file mlstrustedobject
+            attribute ksu_attr
+            allow domain ksu_file file { read open getattr }
+            allow { domain ksu } { ksu_file system_file } { file dir } { read open }
+            allow * ksu_file dir *
+            dontaudit domain ksu_file file write
+            allowxperm domain ksu_file blk_file ioctl 0x1234
+            type_transition system_server ksu_file file ksu_file
+            type_change system_server ksu_file file ksu_file
+            permissive ksu_file
+            genfscon proc ksu ksu_file
+        ";
+        let statements = parse_sepolicy(policy, true).unwrap();
+        let policies = flatten_atomic_statements(&statements).unwrap();
+        let flat = expand_sets(&policies);
+        assert_eq!(
+            policies
+                .iter()
+                .map(AtomicStatement::combinations)
+                .sum::<usize>(),
+            flat.len()
+        );
+
+        let inline = serialize_inline(&flat).unwrap();
+        let compact = serialize_compact(&flat).unwrap();
+        let compact_sets = serialize_compact(&policies).unwrap();
+
+        assert!(serialize_inline(&policies).is_err());
+        assert_eq!(decode_inline(&inline), expected(&flat));
+        assert_eq!(decode_compact(&compact), expected(&flat));
+        assert_eq!(decode_compact(&compact_sets), expected(&flat));
+        assert!(compact.len() < inline.len());
+        assert!(compact_sets.len() < compact.len());
+    }
+
+    #[test]
+    fn set_table_counts_stay_within_members() {
+        assert!(set_table_fits(2, &[2, 1, 2, 1, 3]));
+        // a first count that reaches into the count of the next set
+        assert!(!set_table_fits(2, &[3, 1, 1, 1]));
+        assert!(!set_table_fits(1, &[0]));
+        assert!(!set_table_fits(2, &[1, 1]));
+        assert!(!set_table_fits(1, &[1, 1, 1]));
+    }
+
+    #[test]
+    fn expand_order_matches_nested_loops() {
+        let statements = parse_sepolicy("allow { a b } c file { read write }", true).unwrap();
+        let policies = flatten_atomic_statements(&statements).unwrap();
+        assert_eq!(policies.len(), 1);
+
+        let names: Vec<(Option<Vec<u8>>, Option<Vec<u8>>)> = expected(&expand_sets(&policies))
+            .into_iter()
+            .map(|(_, _, args)| (args[0].clone(), args[3].clone()))
+            .collect();
+        let one = |s: &str| Some(s.as_bytes().to_vec());
+        assert_eq!(
+            names,
+            vec![
+                (one("a"), one("read")),
+                (one("a"), one("write")),
+                (one("b"), one("read")),
+                (one("b"), one("write")),
+            ]
+        );
+    }
+
+    #[test]
+    fn avc_misses_sum_all_cpus() {
+        let stats = "lookups hits misses allocations reclaims frees\n\
+                     120 100 20 20 0 0\n\
+                     80 75 5 5 0 0\n";
+        assert_eq!(parse_avc_misses(stats), Some(25));
+        assert_eq!(parse_avc_misses("lookups hits\n1 1\n"), None);
+        assert_eq!(parse_avc_misses(""), None);
+    }
+
+    #[test]
+    fn compiled_cache_entry_round_trip() {
+        let payload = b"SEP2 payload".to_vec();
+        let entry = encode_compiled(&payload, 42);
+        assert_eq!(decode_compiled(entry), Some((payload, 42)));
+        assert_eq!(decode_compiled(encode_compiled(&[], 0)), Some((vec![], 0)));
+        assert_eq!(decode_compiled(vec![1, 2, 3]), None);
+    }
+
+    #[test]
+    fn compact_wide_refs() {
+        let policies: Vec<AtomicStatement> = (0..70_000)
+            .map(|i| {
+                AtomicStatement::new(
+                    crate::ksu_uapi::KSU_SEPOLICY_CMD_TYPE,
+                    0,
+                    PolicyObject::try_from(format!("t{i}").as_str()).unwrap(),
+                    PolicyObject::try_from("domain").unwrap(),
+                    PolicyObject::None,
+                    PolicyObject::None,
+                    PolicyObject::None,
+                    PolicyObject::None,
+                    PolicyObject::None,
+                )
+            })
+            .collect();
+
+        let compact = serialize_compact(&policies).unwrap();
+        let flags = u32::from_ne_bytes(compact[4..8].try_into().unwrap());
+        assert_eq!(flags & crate::ksu_uapi::KSU_SEPOLICY_COMPACT_REF16, 0);
+        assert_eq!(decode_compact(&compact), expected(&policies));
+    }
+}
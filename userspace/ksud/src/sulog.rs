@@ -1,8 +1,8 @@
 use anyhow::{Context, Result, bail, ensure};
-use chrono::{Days, Local, NaiveDate};
+use chrono::{Days, Local, NaiveDate, NaiveDateTime, NaiveTime, TimeZone};
 use std::fmt::Write as FmtWrite;
 use std::fs::{self, DirBuilder, File, OpenOptions, Permissions};
-use std::io::{self, ErrorKind, LineWriter, Write};
+use std::io::{self, ErrorKind, Write};
 use std::mem::size_of;
 use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
 use std::os::unix::fs::{DirBuilderExt, OpenOptionsExt, PermissionsExt};
@@ -10,20 +10,35 @@ use std::os::unix::process::CommandExt;
 use std::path::{Path, PathBuf};
 use std::process::{Command, Stdio};
 use std::thread;
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
+use crate::sulog_segment::{self, QueryFilter, SegmentWriter};
 use crate::{defs, ksucalls, module_config, utils};
 
 const KSU_EVENT_QUEUE_TYPE_DROPPED: u16 = u16::MAX;
 const KSU_EVENT_RECORD_FLAG_INTERNAL: u16 = 1;
+const KSU_EVENT_RECORD_CLOCK_SHIFT: u16 = 1;
+const KSU_EVENT_RECORD_CLOCK_MASK: u16 = 0x3;
+const KSU_EVENT_RECORD_REPEAT_SHIFT: u16 = 4;
+const KSU_EVENT_RECORD_REPEAT_MAX: u16 = 0xFFF;
 const TASK_COMM_LEN: usize = 16;
-const READ_BUF_SIZE: usize = 8192;
+const READ_BUF_MIN: usize = 8192;
+const READ_BUF_MAX: usize = 256 * 1024;
+/// Frames larger than this can only come from a corrupted stream
+const MAX_FRAME_LEN: usize = 64 * 1024;
+/// Batched output is written once it grows past this, or when the queue drains
+const SULOG_WRITE_BATCH: usize = 64 * 1024;
+/// fsync once this much was written since the last sync...
+const SULOG_SYNC_BYTES: u64 = 256 * 1024;
+/// ...or once the oldest unsynced write is this old
+const SULOG_SYNC_INTERVAL: Duration = Duration::from_secs(5);
 const SULOGD_RESTART_DELAY: Duration = Duration::from_secs(3);
 const SULOG_DIR_MODE: u32 = 0o700;
 const SULOG_FILE_MODE: u32 = 0o600;
 pub const SULOG_CONFIG_MODULE_ID: &str = "internal.ksud.sulogd";
 const SULOG_RETENTION_CONFIG_KEY: &str = "log.retention.days";
 const SULOG_MAX_FILE_SIZE_CONFIG_KEY: &str = "log.max_file_size";
+const SULOG_FORMAT_CONFIG_KEY: &str = "log.format";
 const DEFAULT_SULOG_RETENTION_DAYS: u64 = 3;
 const DEFAULT_SULOG_MAX_FILE_SIZE: u64 = 10 * 1024 * 1024;
 
@@ -76,6 +91,17 @@ struct SulogEvent {
     argv: String,
 }
 
+/// Reassembles kernel frames across read boundaries. The read size follows
+/// recent bursts so a single read usually drains the whole queue.
+struct FrameAssembler {
+    buf: Vec<u8>,
+    /// Bytes of an incomplete frame kept from the previous read
+    carry: usize,
+    read_size: usize,
+    /// Bytes read since the queue last drained
+    burst: usize,
+}
+
 enum ReadState {
     Drained,
     Closed,
@@ -95,13 +121,46 @@ struct DailyLogWriter {
     current_index: u32,
     current_size: u64,
     max_file_size: u64,
-    writer: LineWriter<File>,
+    file: File,
+    /// Lines of the current read batch, written by `flush`
+    pending: Vec<u8>,
+    /// Bytes written to the stores since the last fsync
+    unsynced: u64,
+    last_sync: Instant,
+    /// Event lines go to the text log; daemon markers always do
+    text_events: bool,
+    segment: Option<SegmentWriter>,
+}
+
+/// Which store sulogd writes kernel records to
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum LogFormat {
+    Text,
+    Binary,
+    Both,
 }
 
+const _: () = assert!(size_of::<EventRecordHeader>() == sulog_segment::FRAME_HEADER_LEN);
+
 impl EventRecordHeader {
     fn parse(bytes: &[u8]) -> Result<Self> {
         read_packed_struct(bytes)
     }
+
+    /// Clock `ts_ns` was taken from; monotonic is the historical default and is left implicit
+    const fn clock_suffix(&self) -> &'static str {
+        match (self.flags >> KSU_EVENT_RECORD_CLOCK_SHIFT) & KSU_EVENT_RECORD_CLOCK_MASK {
+            0 => "",
+            1 => " clock=boottime",
+            2 => " clock=mono_fast",
+            _ => " clock=unknown",
+        }
+    }
+
+    /// Identical records the kernel folded into this one, not counting itself
+    const fn repeat_count(&self) -> u16 {
+        (self.flags >> KSU_EVENT_RECORD_REPEAT_SHIFT) & KSU_EVENT_RECORD_REPEAT_MAX
+    }
 }
 
 impl DroppedInfo {
@@ -165,13 +224,71 @@ impl SulogEvent {
     }
 
     const fn event_name(&self) -> &'static str {
-        match self.event_type {
-            1 => "root_execve",
-            2 => "sucompat",
-            3 => "ioctl_grant_root",
-            _ => "unknown",
-        }
+        event_type_name(self.event_type)
+    }
+}
+
+const SULOG_EVENT_TYPES: [u16; 3] = [1, 2, 3];
+
+const fn event_type_name(event_type: u16) -> &'static str {
+    match event_type {
+        1 => "root_execve",
+        2 => "sucompat",
+        3 => "ioctl_grant_root",
+        _ => "unknown",
+    }
+}
+
+fn parse_event_type(name: &str) -> Result<u16> {
+    if let Ok(event_type) = name.parse::<u16>() {
+        ensure!(event_type < 32, "event type {event_type} out of range");
+        return Ok(event_type);
+    }
+    SULOG_EVENT_TYPES
+        .into_iter()
+        .find(|&t| event_type_name(t) == name)
+        .with_context(|| format!("unknown event type: {name}"))
+}
+
+/// Build the kernel filter mask from event type names, empty means all types
+pub fn parse_filter_type_mask(names: &[String]) -> Result<u32> {
+    if names.is_empty() {
+        return Ok(u32::MAX);
+    }
+    let mut mask = 0u32;
+    for name in names {
+        mask |= 1u32 << parse_event_type(name)?;
+    }
+    Ok(mask)
+}
+
+fn format_filter_type_mask(mask: u32) -> String {
+    if mask == u32::MAX {
+        return "all".to_string();
+    }
+    let names: Vec<&str> = SULOG_EVENT_TYPES
+        .into_iter()
+        .filter(|&t| mask & (1u32 << t) != 0)
+        .map(event_type_name)
+        .collect();
+    if names.is_empty() {
+        "none".to_string()
+    } else {
+        names.join(",")
+    }
+}
+
+pub fn print_filter_status(cmd: &crate::ksu_uapi::ksu_sulog_filter_cmd) {
+    println!("types: {}", format_filter_type_mask(cmd.type_mask));
+    if cmd.rate == 0 {
+        println!("rate: unlimited");
+    } else {
+        println!("rate: {}/s per uid, burst {}", cmd.rate, cmd.burst);
     }
+    println!("uid_rules: {}", cmd.uid_rules);
+    println!("filtered_uid: {}", cmd.filtered_uid);
+    println!("filtered_type: {}", cmd.filtered_type);
+    println!("filtered_rate: {}", cmd.filtered_rate);
 }
 
 impl SulogdLockGuard {
@@ -199,43 +316,129 @@ impl DailyLogWriter {
         let config = ensure_sulog_config()?;
         cleanup_expired_logs(config.retention_days)?;
         let current_day = current_log_day();
-        let (current_index, current_size, writer) =
-            open_log_writer_for_day(&current_day, config.max_file_size)?;
+        let (current_index, current_size, file) =
+            open_log_file_for_day(&current_day, config.max_file_size)?;
+        let segment = open_segment_writer(config, &current_day)?;
         Ok(Self {
             current_day,
             current_index,
             current_size,
             max_file_size: config.max_file_size,
-            writer,
+            file,
+            pending: Vec::with_capacity(SULOG_WRITE_BATCH),
+            unsynced: 0,
+            last_sync: Instant::now(),
+            text_events: config.format != LogFormat::Binary,
+            segment,
         })
     }
 
-    fn rotate_if_needed(&mut self, next_write_len: usize) -> Result<()> {
+    /// Switch every store to a new day, returns true if it did
+    fn roll_day_if_needed(&mut self) -> Result<bool> {
         let current_day = current_log_day();
+        if current_day == self.current_day {
+            return Ok(false);
+        }
+
+        self.sync()?;
+        let config = ensure_sulog_config()?;
+        cleanup_expired_logs(config.retention_days)?;
+        let (current_index, current_size, file) =
+            open_log_file_for_day(&current_day, config.max_file_size)?;
+        self.segment = open_segment_writer(config, &current_day)?;
+        self.file = file;
+        self.current_day = current_day;
+        self.current_index = current_index;
+        self.current_size = current_size;
+        self.max_file_size = config.max_file_size;
+        self.text_events = config.format != LogFormat::Binary;
+        Ok(true)
+    }
+
+    fn rotate_if_needed(&mut self, next_write_len: usize) -> Result<()> {
         let next_write_len = u64::try_from(next_write_len).context("invalid log line length")?;
-        if current_day != self.current_day {
-            let config = ensure_sulog_config()?;
-            cleanup_expired_logs(config.retention_days)?;
-            let (current_index, current_size, writer) =
-                open_log_writer_for_day(&current_day, config.max_file_size)?;
-            self.writer = writer;
-            self.current_day = current_day;
-            self.current_index = current_index;
-            self.current_size = current_size;
-            self.max_file_size = config.max_file_size;
+        if self.roll_day_if_needed()? {
             return Ok(());
         }
 
         if self.current_size > 0
             && self.current_size.saturating_add(next_write_len) > self.max_file_size
         {
+            self.sync()?;
             self.current_index = self.current_index.saturating_add(1);
             let path = daily_log_path(&self.current_day, self.current_index);
-            self.writer = open_line_writer(&path)?;
+            self.file = open_log_file(&path)?;
             self.current_size = 0;
         }
         Ok(())
     }
+
+    fn write_pending(&mut self) -> Result<()> {
+        let mut written = 0usize;
+        if !self.pending.is_empty() {
+            self.file
+                .write_all(&self.pending)
+                .context("failed to write sulog lines")?;
+            written += self.pending.len();
+            self.pending.clear();
+        }
+        if let Some(segment) = self.segment.as_mut() {
+            written += segment.pending_len();
+            segment.flush()?;
+        }
+        self.unsynced = self.unsynced.saturating_add(written as u64);
+        Ok(())
+    }
+
+    /// Write out the batched lines and segment frames, then fsync if due
+    fn flush(&mut self) -> Result<()> {
+        self.write_pending()?;
+        if self.unsynced >= SULOG_SYNC_BYTES
+            || (self.unsynced > 0 && self.last_sync.elapsed() >= SULOG_SYNC_INTERVAL)
+        {
+            self.sync()?;
+        }
+        Ok(())
+    }
+
+    fn flush_if_full(&mut self) -> Result<()> {
+        let segment_len = self.segment.as_ref().map_or(0, SegmentWriter::pending_len);
+        if self.pending.len() >= SULOG_WRITE_BATCH || segment_len >= SULOG_WRITE_BATCH {
+            self.flush()?;
+        }
+        Ok(())
+    }
+
+    /// Flush and fsync every store, e.g. before switching files
+    fn sync(&mut self) -> Result<()> {
+        self.write_pending()?;
+        if self.unsynced > 0 {
+            self.file.sync_data().context("failed to sync sulog file")?;
+            if let Some(segment) = self.segment.as_mut() {
+                segment.sync()?;
+            }
+        }
+        self.unsynced = 0;
+        self.last_sync = Instant::now();
+        Ok(())
+    }
+
+    /// epoll timeout until the pending fsync is due, -1 if nothing is waiting
+    fn sync_timeout_ms(&self) -> i32 {
+        if self.unsynced == 0 {
+            return -1;
+        }
+        let remaining = SULOG_SYNC_INTERVAL.saturating_sub(self.last_sync.elapsed());
+        i32::try_from(remaining.as_millis()).unwrap_or(i32::MAX)
+    }
+}
+
+impl Drop for DailyLogWriter {
+    fn drop(&mut self) {
+        if let Err(err) = self.sync() {
+            log::warn!("failed to flush sulog on close: {err:#}");
+        }
+    }
 }
 
 fn parse_c_string(bytes: &[u8]) -> String {
@@ -289,10 +492,22 @@ fn parse_max_file_size(value: &str) -> Result<u64> {
     Ok(size)
 }
 
+fn parse_log_format(value: &str) -> Result<LogFormat> {
+    match value.trim() {
+        "text" => Ok(LogFormat::Text),
+        "binary" => Ok(LogFormat::Binary),
+        "both" => Ok(LogFormat::Both),
+        other => bail!(
+            "invalid {SULOG_FORMAT_CONFIG_KEY} value: '{other}', expected text, binary or both"
+        ),
+    }
+}
+
 #[derive(Clone, Copy, Debug)]
 struct SulogConfig {
     retention_days: u64,
     max_file_size: u64,
+    format: LogFormat,
 }
 
 fn ensure_config_value(key: &str, default_value: u64) -> Result<String> {
@@ -320,14 +535,32 @@ fn ensure_sulog_config() -> Result<SulogConfig> {
         SULOG_MAX_FILE_SIZE_CONFIG_KEY,
         DEFAULT_SULOG_MAX_FILE_SIZE,
     )?)?;
+    // optional, text stays the default and is not persisted
+    let format = module_config::merge_configs(SULOG_CONFIG_MODULE_ID)?
+        .get(SULOG_FORMAT_CONFIG_KEY)
+        .map_or(Ok(LogFormat::Text), |value| parse_log_format(value))?;
     Ok(SulogConfig {
         retention_days,
         max_file_size,
+        format,
     })
 }
 
+fn open_segment_writer(config: SulogConfig, day: &str) -> Result<Option<SegmentWriter>> {
+    if config.format == LogFormat::Text {
+        return Ok(None);
+    }
+    SegmentWriter::open(Path::new(defs::LOG_DIR), day, config.max_file_size).map(Some)
+}
+
 fn parse_log_date_from_path(path: &Path) -> Option<NaiveDate> {
-    parse_log_name(path).map(|(date, _)| date)
+    if let Some((date, _)) = parse_log_name(path) {
+        return Some(date);
+    }
+    // segment index sidecars expire together with their segment
+    let segment_path = path.with_extension(&sulog_segment::SEGMENT_EXT[1..]);
+    let (day, _) = sulog_segment::parse_segment_name(&segment_path)?;
+    NaiveDate::parse_from_str(&day, "%Y-%m-%d").ok()
 }
 
 fn parse_log_name(path: &Path) -> Option<(NaiveDate, u32)> {
@@ -393,7 +626,7 @@ fn ensure_private_dir_exists(path: &Path) -> Result<()> {
     Ok(())
 }
 
-fn open_line_writer(path: &Path) -> Result<LineWriter<File>> {
+fn open_log_file(path: &Path) -> Result<File> {
     let file = OpenOptions::new()
         .create(true)
         .append(true)
@@ -408,10 +641,10 @@ fn open_line_writer(path: &Path) -> Result<LineWriter<File>> {
                 SULOG_FILE_MODE
             )
         })?;
-    Ok(LineWriter::new(file))
+    Ok(file)
 }
 
-fn open_log_writer_for_day(day: &str, max_file_size: u64) -> Result<(u32, u64, LineWriter<File>)> {
+fn open_log_file_for_day(day: &str, max_file_size: u64) -> Result<(u32, u64, File)> {
     let mut highest_index = 0u32;
     let mut found = false;
     for entry in
@@ -437,8 +670,8 @@ fn open_log_writer_for_day(day: &str, max_file_size: u64) -> Result<(u32, u64, L
         current_size = fs::metadata(&path).map_or(0, |meta| meta.len());
     }
 
-    let writer = open_line_writer(&path)?;
-    Ok((index, current_size, writer))
+    let file = open_log_file(&path)?;
+    Ok((index, current_size, file))
 }
 
 fn read_boot_id() -> Result<String> {
@@ -496,9 +729,10 @@ fn format_event_line(header: &EventRecordHeader, event: &SulogEvent) -> String {
     let parent_process_id = event.ppid;
     let uid = event.uid;
     let euid = event.euid;
-    format!(
-        "ts_ns={} seq={} type={} version={} retval={} pid={} tgid={} ppid={} uid={} euid={} comm=\"{}\" file=\"{}\" argv=\"{}\"",
+    let mut line = format!(
+        "ts_ns={}{} seq={} type={} version={} retval={} pid={} tgid={} ppid={} uid={} euid={} comm=\"{}\" file=\"{}\" argv=\"{}\"",
         ts_ns,
+        header.clock_suffix(),
         seq,
         event.event_name(),
         version,
@@ -511,7 +745,12 @@ fn format_event_line(header: &EventRecordHeader, event: &SulogEvent) -> String {
         escape_field(&event.comm),
         escape_field(&event.file),
         escape_field(&event.argv),
-    )
+    );
+    let repeat = header.repeat_count();
+    if repeat > 0 {
+        let _ = write!(line, " repeated {repeat} times");
+    }
+    line
 }
 
 fn format_dropped_line(header: &EventRecordHeader, info: &DroppedInfo) -> String {
@@ -520,26 +759,25 @@ fn format_dropped_line(header: &EventRecordHeader, info: &DroppedInfo) -> String
     let dropped = info.dropped;
     let first_seq = info.first_seq;
     let last_seq = info.last_seq;
+    let clock = header.clock_suffix();
     format!(
-        "ts_ns={ts_ns} seq={seq} type=dropped dropped={dropped} first_seq={first_seq} last_seq={last_seq}"
+        "ts_ns={ts_ns}{clock} seq={seq} type=dropped dropped={dropped} first_seq={first_seq} last_seq={last_seq}"
     )
 }
 
-fn write_log_line(writer: &mut DailyLogWriter, line: &str) -> io::Result<()> {
+/// Queue one line into the current batch, see `DailyLogWriter::flush`
+fn write_log_line(writer: &mut DailyLogWriter, line: &str) -> Result<()> {
     let write_len = line
         .len()
         .checked_add(1)
-        .ok_or_else(|| io::Error::other("sulog line length overflow"))?;
-    writer
-        .rotate_if_needed(write_len)
-        .map_err(io::Error::other)?;
-    writer.writer.write_all(line.as_bytes())?;
-    writer.writer.write_all(b"\n")?;
-    writer.writer.flush()?;
+        .context("sulog line length overflow")?;
+    writer.rotate_if_needed(write_len)?;
+    writer.pending.extend_from_slice(line.as_bytes());
+    writer.pending.push(b'\n');
     writer.current_size = writer
         .current_size
-        .saturating_add(u64::try_from(write_len).map_err(io::Error::other)?);
-    Ok(())
+        .saturating_add(u64::try_from(write_len).context("invalid log line length")?);
+    writer.flush_if_full()
 }
 
 fn format_record_line(header: EventRecordHeader, payload: &[u8]) -> Result<String> {
@@ -556,12 +794,155 @@ fn format_record_line(header: EventRecordHeader, payload: &[u8]) -> Result<Strin
     Ok(format_event_line(&header, &event))
 }
 
-fn handle_readable(fd: RawFd, writer: &mut DailyLogWriter) -> Result<ReadState> {
-    let mut buf = [0u8; READ_BUF_SIZE];
+fn record_uid(header: &EventRecordHeader, payload: &[u8]) -> u32 {
+    if header.record_type == KSU_EVENT_QUEUE_TYPE_DROPPED {
+        return sulog_segment::UID_NONE;
+    }
+    SulogEventHeader::parse(payload).map_or(sulog_segment::UID_NONE, |event| event.uid)
+}
+
+fn current_minute() -> u32 {
+    u32::try_from(Local::now().timestamp() / 60).unwrap_or(u32::MAX)
+}
+
+fn store_record(
+    writer: &mut DailyLogWriter,
+    header: EventRecordHeader,
+    frame: &[u8],
+) -> Result<()> {
+    let payload = &frame[size_of::<EventRecordHeader>()..];
+
+    writer.roll_day_if_needed()?;
+    if let Some(segment) = writer.segment.as_mut() {
+        segment
+            .append(frame, record_uid(&header, payload), current_minute())
+            .context("failed to write sulog segment")?;
+    }
+
+    if !writer.text_events {
+        return writer.flush_if_full();
+    }
+
+    match format_record_line(header, payload) {
+        Ok(line) => {
+            write_log_line(writer, &line).context("failed to write sulog line")?;
+        }
+        Err(err) => {
+            let seq = header.seq;
+            let record_type = header.record_type;
+            log::warn!("dropping malformed sulog record seq={seq} type={record_type}: {err:#}");
+        }
+    }
+    Ok(())
+}
+
+fn handle_readable(
+    fd: RawFd,
+    assembler: &mut FrameAssembler,
+    writer: &mut DailyLogWriter,
+) -> Result<ReadState> {
+    let state = drain_sulog_fd(fd, assembler, writer);
+    // one write per store for the whole batch, also when draining failed halfway
+    let flushed = writer.flush();
+    let state = state?;
+    flushed?;
+    Ok(state)
+}
+
+impl FrameAssembler {
+    const fn new() -> Self {
+        Self {
+            buf: Vec::new(),
+            carry: 0,
+            read_size: READ_BUF_MIN,
+            burst: 0,
+        }
+    }
+
+    /// Room for the next read, behind the carried-over bytes
+    fn spare(&mut self) -> &mut [u8] {
+        let end = self.carry + self.read_size;
+        if self.buf.len() < end {
+            self.buf.resize(end, 0);
+        }
+        &mut self.buf[self.carry..end]
+    }
+
+    /// The next frame does not fit into a read, returns false at the cap
+    fn grow(&mut self) -> bool {
+        if self.read_size >= READ_BUF_MAX {
+            return false;
+        }
+        self.read_size = (self.read_size * 2).min(READ_BUF_MAX);
+        true
+    }
+
+    /// Take `len` bytes just read into `spare` and pass every complete frame to `store`
+    fn feed<F>(&mut self, len: usize, mut store: F) -> Result<()>
+    where
+        F: FnMut(EventRecordHeader, &[u8]) -> Result<()>,
+    {
+        self.burst = self.burst.saturating_add(len);
+        let end = self.carry + len;
+        let mut offset = 0usize;
 
+        while end - offset >= size_of::<EventRecordHeader>() {
+            let header = EventRecordHeader::parse(&self.buf[offset..end])?;
+            let frame_len =
+                size_of::<EventRecordHeader>().saturating_add(header.payload_len as usize);
+            if frame_len > MAX_FRAME_LEN {
+                // nothing after a bogus length can be trusted to be aligned to a frame
+                let seq = header.seq;
+                log::warn!(
+                    "dropping {} bytes of sulog stream, bad frame length {frame_len} at seq={seq}",
+                    end - offset
+                );
+                offset = end;
+                break;
+            }
+            if end - offset < frame_len {
+                break;
+            }
+
+            store(header, &self.buf[offset..offset + frame_len])?;
+            offset += frame_len;
+        }
+
+        self.buf.copy_within(offset..end, 0);
+        self.carry = end - offset;
+        Ok(())
+    }
+
+    /// The queue drained, size the next reads after this burst
+    fn end_burst(&mut self) {
+        let target = self
+            .burst
+            .next_power_of_two()
+            .clamp(READ_BUF_MIN, READ_BUF_MAX);
+        // grow at once, shrink gradually so alternating bursts do not thrash
+        self.read_size = if target >= self.read_size {
+            target
+        } else {
+            (self.read_size / 2).max(target)
+        };
+        self.burst = 0;
+
+        if self.buf.len() > 2 * (self.carry + self.read_size) {
+            self.buf.truncate(self.carry + self.read_size);
+            self.buf.shrink_to_fit();
+        }
+    }
+}
+
+fn drain_sulog_fd(
+    fd: RawFd,
+    assembler: &mut FrameAssembler,
+    writer: &mut DailyLogWriter,
+) -> Result<ReadState> {
     loop {
+        let spare = assembler.spare();
         let read_len =
-            unsafe { libc::read(fd, buf.as_mut_ptr().cast::<libc::c_void>(), buf.len()) };
+            unsafe { libc::read(fd, spare.as_mut_ptr().cast::<libc::c_void>(), spare.len()) };
         if read_len < 0 {
             let err = io::Error::last_os_error();
             if err.raw_os_error() == Some(libc::EINTR) {
@@ -570,8 +951,13 @@ fn handle_readable(fd: RawFd, writer: &mut DailyLogWriter) -> Result<ReadState>
             if matches!(err.kind(), ErrorKind::WouldBlock)
                 || err.raw_os_error() == Some(libc::EAGAIN)
             {
+                assembler.end_burst();
                 return Ok(ReadState::Drained);
             }
+            // the kernel never splits a frame, give it a larger buffer
+            if err.raw_os_error() == Some(libc::EMSGSIZE) && assembler.grow() {
+                continue;
+            }
             return Err(err).context("failed to read sulog event queue");
         }
 
@@ -580,54 +966,9 @@ fn handle_readable(fd: RawFd, writer: &mut DailyLogWriter) -> Result<ReadState>
         }
 
         let read_len = usize::try_from(read_len).context("negative sulog read length")?;
-        let mut offset = 0usize;
-
-        while offset < read_len {
-            let remaining = read_len - offset;
-            if remaining < size_of::<EventRecordHeader>() {
-                log::warn!("dropping truncated sulog frame header: {remaining} bytes remaining");
-                break;
-            }
-
-            let header =
-                EventRecordHeader::parse(&buf[offset..offset + size_of::<EventRecordHeader>()])?;
-            let payload_len = match usize::try_from(header.payload_len) {
-                Ok(payload_len) => payload_len,
-                Err(err) => {
-                    let seq = header.seq;
-                    log::warn!(
-                        "dropping sulog frame with invalid payload length at seq={seq}: {err:#}"
-                    );
-                    break;
-                }
-            };
-            let Some(frame_len) = size_of::<EventRecordHeader>().checked_add(payload_len) else {
-                let seq = header.seq;
-                log::warn!("dropping sulog frame with overflowing length at seq={seq}");
-                break;
-            };
-            if remaining < frame_len {
-                log::warn!(
-                    "dropping truncated sulog frame payload: need {frame_len}, got {remaining}"
-                );
-                break;
-            }
-
-            let payload = &buf[offset + size_of::<EventRecordHeader>()..offset + frame_len];
-            match format_record_line(header, payload) {
-                Ok(line) => {
-                    write_log_line(writer, &line).context("failed to write sulog line")?;
-                }
-                Err(err) => {
-                    let seq = header.seq;
-                    let record_type = header.record_type;
-                    log::warn!(
-                        "dropping malformed sulog record seq={seq} type={record_type}: {err:#}"
-                    );
-                }
-            }
-            offset += frame_len;
-        }
+        assembler.feed(read_len, |header, frame| {
+            store_record(writer, header, frame)
+        })?;
     }
 }
 
@@ -662,12 +1003,14 @@ fn write_session_marker(
             escape_field(boot_id)
         )
     };
-    write_log_line(writer, &line).context("failed to write sulogd session marker")
+    write_log_line(writer, &line).context("failed to write sulogd session marker")?;
+    writer.flush()
 }
 
 fn run_sulog_session(restart_count: u64) -> Result<SessionExitReason> {
     let sulog_fd = open_sulog_fd().context("failed to open sulog fd")?;
     let mut writer = DailyLogWriter::open()?;
+    let mut assembler = FrameAssembler::new();
     let boot_id = read_boot_id()?;
 
     let epoll_raw = unsafe { libc::epoll_create1(libc::EPOLL_CLOEXEC) };
@@ -706,7 +1049,7 @@ fn run_sulog_session(restart_count: u64) -> Result<SessionExitReason> {
                 epoll_fd.as_raw_fd(),
                 events.as_mut_ptr(),
                 i32::try_from(events.len()).context("too many epoll events")?,
-                -1,
+                writer.sync_timeout_ms(),
             )
         };
         if ready < 0 {
@@ -718,10 +1061,15 @@ fn run_sulog_session(restart_count: u64) -> Result<SessionExitReason> {
         }
 
         let ready = usize::try_from(ready).context("invalid epoll ready count")?;
+        if ready == 0 {
+            // quiet after a burst, make the tail durable
+            writer.sync()?;
+            continue;
+        }
         for ready_event in &events[..ready] {
             let event_mask = ready_event.events;
             if event_mask & u32::try_from(libc::EPOLLIN).context("invalid EPOLLIN")? != 0 {
-                match handle_readable(sulog_fd.as_raw_fd(), &mut writer)? {
+                match handle_readable(sulog_fd.as_raw_fd(), &mut assembler, &mut writer)? {
                     ReadState::Drained => {}
                     ReadState::Closed => {
                         log::warn!("sulog fd closed");
@@ -733,7 +1081,7 @@ fn run_sulog_session(restart_count: u64) -> Result<SessionExitReason> {
             let hup_mask =
                 u32::try_from(libc::EPOLLERR | libc::EPOLLHUP).context("invalid EPOLLHUP mask")?;
             if event_mask & hup_mask != 0 {
-                match handle_readable(sulog_fd.as_raw_fd(), &mut writer)? {
+                match handle_readable(sulog_fd.as_raw_fd(), &mut assembler, &mut writer)? {
                     ReadState::Drained | ReadState::Closed => {}
                 }
                 log::warn!("sulog epoll hangup");
@@ -799,3 +1147,311 @@ pub fn spawn_sulogd() -> Result<()> {
 pub fn ensure_sulogd_running() -> Result<()> {
     spawn_sulogd()
 }
+
+/// Parse `YYYY-MM-DD` or `YYYY-MM-DD HH:MM` local time into epoch minutes.
+/// A bare date covers the whole day, so `until` maps it to its last minute.
+fn parse_query_time(value: &str, until: bool) -> Result<u32> {
+    let value = value.trim();
+    let naive = if let Ok(date) = NaiveDate::parse_from_str(value, "%Y-%m-%d") {
+        let time = if until {
+            NaiveTime::from_hms_opt(23, 59, 0)
+        } else {
+            NaiveTime::from_hms_opt(0, 0, 0)
+        };
+        date.and_time(time.context("invalid time of day")?)
+    } else {
+        NaiveDateTime::parse_from_str(value, "%Y-%m-%d %H:%M")
+            .with_context(|| format!("invalid time '{value}', expected YYYY-MM-DD[ HH:MM]"))?
+    };
+    let local = Local
+        .from_local_datetime(&naive)
+        .earliest()
+        .with_context(|| format!("time '{value}' does not exist in local timezone"))?;
+    u32::try_from(local.timestamp() / 60).with_context(|| format!("time '{value}' out of range"))
+}
+
+fn minute_to_local(minute: u32) -> Option<chrono::DateTime<Local>> {
+    Local.timestamp_opt(i64::from(minute) * 60, 0).single()
+}
+
+/// Print records from binary segments that match the filters, using the sidecar
+/// index so only matching frames are read.
+pub fn query(
+    uid: Option<u32>,
+    since: Option<&str>,
+    until: Option<&str>,
+    types: &[String],
+    limit: Option<usize>,
+) -> Result<()> {
+    let filter = QueryFilter {
+        uid,
+        since_minute: since
+            .map(|value| parse_query_time(value, false))
+            .transpose()?,
+        until_minute: until
+            .map(|value| parse_query_time(value, true))
+            .transpose()?,
+    };
+    let type_mask = parse_filter_type_mask(types)?;
+    let since_day = filter
+        .since_minute
+        .and_then(minute_to_local)
+        .map(|time| time.date_naive());
+    let until_day = filter
+        .until_minute
+        .and_then(minute_to_local)
+        .map(|time| time.date_naive());
+
+    let mut printed = 0usize;
+    for (day, _, path) in sulog_segment::list_segments(Path::new(defs::LOG_DIR))? {
+        let Ok(day) = NaiveDate::parse_from_str(&day, "%Y-%m-%d") else {
+            continue;
+        };
+        if since_day.is_some_and(|since| day < since) || until_day.is_some_and(|until| day > until)
+        {
+            continue;
+        }
+
+        let more = sulog_segment::query_segment(&path, &filter, |entry, frame| {
+            if limit.is_some_and(|limit| printed >= limit) {
+                return Ok(false);
+            }
+            let header = EventRecordHeader::parse(frame)?;
+            let record_type = header.record_type;
+            let wanted = if record_type == KSU_EVENT_QUEUE_TYPE_DROPPED {
+                type_mask == u32::MAX
+            } else {
+                record_type < 32 && type_mask & (1u32 << record_type) != 0
+            };
+            if !wanted {
+                return Ok(true);
+            }
+
+            match format_record_line(header, &frame[size_of::<EventRecordHeader>()..]) {
+                Ok(line) => {
+                    let time = minute_to_local(entry.minute).map_or_else(String::new, |time| {
+                        time.format("%Y-%m-%dT%H:%M").to_string()
+                    });
+                    println!("time={time} {line}");
+                    printed += 1;
+                }
+                Err(err) => {
+                    let seq = header.seq;
+                    log::warn!("skipping malformed sulog record seq={seq}: {err:#}");
+                }
+            }
+            Ok(true)
+        })
+        .with_context(|| format!("failed to query {}", path.display()))?;
+        if !more {
+            break;
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn record_header(flags: u16) -> EventRecordHeader {
+        EventRecordHeader {
+            record_type: 2,
+            flags,
+            payload_len: 0,
+            seq: 7,
+            ts_ns: 42,
+        }
+    }
+
+    fn event_payload(pid: u32, argv: &str) -> Vec<u8> {
+        let file = b"/system/bin/sh\0";
+        let argv = [argv.as_bytes(), b"\0"].concat();
+        let mut comm = [0u8; TASK_COMM_LEN];
+        comm[..2].copy_from_slice(b"sh");
+        let header = SulogEventHeader {
+            version: 1,
+            event_type: 2,
+            retval: 0,
+            pid,
+            tgid: pid,
+            ppid: 1,
+            uid: 2000,
+            euid: 2000,
+            comm,
+            filename_len: u32::try_from(file.len()).unwrap(),
+            argv_len: u32::try_from(argv.len()).unwrap(),
+        };
+        let header_bytes = unsafe {
+            std::slice::from_raw_parts(
+                (&raw const header).cast::<u8>(),
+                size_of::<SulogEventHeader>(),
+            )
+        };
+        [header_bytes, file, &argv].concat()
+    }
+
+    #[test]
+    fn repeat_count_is_read_from_upper_flag_bits() {
+        assert_eq!(record_header(0).repeat_count(), 0);
+        assert_eq!(
+            record_header(KSU_EVENT_RECORD_FLAG_INTERNAL).repeat_count(),
+            0
+        );
+        assert_eq!(
+            record_header(5 << KSU_EVENT_RECORD_REPEAT_SHIFT).repeat_count(),
+            5
+        );
+        assert_eq!(
+            record_header(u16::MAX).repeat_count(),
+            KSU_EVENT_RECORD_REPEAT_MAX
+        );
+    }
+
+    #[test]
+    fn coalesced_record_renders_repeat_count() {
+        let payload = event_payload(100, "-c id");
+        let flags = 3 << KSU_EVENT_RECORD_REPEAT_SHIFT;
+        let line = format_record_line(record_header(flags), &payload).unwrap();
+        assert!(line.ends_with("argv=\"-c id\" repeated 3 times"), "{line}");
+    }
+
+    #[test]
+    fn clock_id_is_rendered_next_to_timestamp() {
+        let payload = event_payload(102, "-c id");
+        let line = format_record_line(record_header(0), &payload).unwrap();
+        assert!(line.starts_with("ts_ns=42 seq=7 "), "{line}");
+
+        let flags = 1 << KSU_EVENT_RECORD_CLOCK_SHIFT;
+        let line = format_record_line(record_header(flags), &payload).unwrap();
+        assert!(line.starts_with("ts_ns=42 clock=boottime seq=7 "), "{line}");
+
+        // clock bits must not leak into the repeat count or the other way around
+        let flags = (2 << KSU_EVENT_RECORD_CLOCK_SHIFT) | (4 << KSU_EVENT_RECORD_REPEAT_SHIFT);
+        let header = record_header(flags);
+        assert_eq!(header.repeat_count(), 4);
+        let line = format_record_line(header, &payload).unwrap();
+        assert!(
+            line.starts_with("ts_ns=42 clock=mono_fast seq=7 "),
+            "{line}"
+        );
+        assert!(line.ends_with(" repeated 4 times"), "{line}");
+    }
+
+    #[test]
+    fn plain_record_has_no_repeat_suffix() {
+        let line = format_record_line(record_header(0), &event_payload(101, "-c ls")).unwrap();
+        assert!(!line.contains("repeated"), "{line}");
+        assert!(line.ends_with("argv=\"-c ls\""), "{line}");
+    }
+
+    fn raw_frame(seq: u64, payload_len: usize) -> Vec<u8> {
+        let header = EventRecordHeader {
+            record_type: 1,
+            flags: 0,
+            payload_len: u32::try_from(payload_len).unwrap(),
+            seq,
+            ts_ns: seq,
+        };
+        let header_bytes = unsafe {
+            std::slice::from_raw_parts(
+                (&raw const header).cast::<u8>(),
+                size_of::<EventRecordHeader>(),
+            )
+        };
+        let payload: Vec<u8> = (0..payload_len).map(|i| (seq as usize + i) as u8).collect();
+        [header_bytes, &payload].concat()
+    }
+
+    /// xorshift64, enough to pick read boundaries without pulling in a rng crate
+    fn next_random(state: &mut u64) -> u64 {
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+        *state
+    }
+
+    #[test]
+    fn frames_survive_arbitrary_read_boundaries() {
+        for seed in 1..=64u64 {
+            let mut rng = seed.wrapping_mul(0x9E37_79B9_7F4A_7C15);
+            let frames: Vec<Vec<u8>> = (0..200)
+                .map(|seq| {
+                    let len = (next_random(&mut rng) % 4096) as usize;
+                    raw_frame(seq, len)
+                })
+                .collect();
+            let stream = frames.concat();
+
+            let mut assembler = FrameAssembler::new();
+            let mut seen = Vec::new();
+            let mut offset = 0usize;
+            while offset < stream.len() {
+                let spare = assembler.spare();
+                let max = spare.len().min(stream.len() - offset);
+                let len = 1 + (next_random(&mut rng) as usize) % max;
+                spare[..len].copy_from_slice(&stream[offset..offset + len]);
+                offset += len;
+                assembler
+                    .feed(len, |header, frame| {
+                        assert_eq!(
+                            frame.len(),
+                            size_of::<EventRecordHeader>() + header.payload_len as usize
+                        );
+                        seen.push(frame.to_vec());
+                        Ok(())
+                    })
+                    .unwrap();
+                if next_random(&mut rng).is_multiple_of(8) {
+                    assembler.end_burst();
+                }
+            }
+
+            assert_eq!(assembler.carry, 0, "seed {seed}");
+            assert_eq!(seen, frames, "seed {seed}");
+        }
+    }
+
+    #[test]
+    fn read_size_follows_bursts_within_bounds() {
+        let mut assembler = FrameAssembler::new();
+        assembler.burst = 100 * 1024;
+        assembler.end_burst();
+        assert_eq!(assembler.read_size, 128 * 1024);
+
+        assembler.burst = 10;
+        assembler.end_burst();
+        assert_eq!(assembler.read_size, 64 * 1024);
+
+        assembler.burst = 16 * 1024 * 1024;
+        assembler.end_burst();
+        assert_eq!(assembler.read_size, READ_BUF_MAX);
+        assert!(!assembler.grow());
+
+        for _ in 0..16 {
+            assembler.end_burst();
+        }
+        assert_eq!(assembler.read_size, READ_BUF_MIN);
+    }
+
+    #[test]
+    fn bad_frame_length_drops_rest_of_buffer() {
+        let mut assembler = FrameAssembler::new();
+        let mut stream = raw_frame(1, 8);
+        let mut bad = raw_frame(2, 0);
+        bad[4..8].copy_from_slice(&u32::MAX.to_ne_bytes());
+        stream.extend_from_slice(&bad);
+
+        let spare = assembler.spare();
+        spare[..stream.len()].copy_from_slice(&stream);
+        let mut seqs = Vec::new();
+        assembler
+            .feed(stream.len(), |header, _| {
+                seqs.push(header.seq);
+                Ok(())
+            })
+            .unwrap();
+        assert_eq!(seqs, vec![1]);
+        assert_eq!(assembler.carry, 0);
+    }
+}
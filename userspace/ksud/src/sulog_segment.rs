@@ -0,0 +1,480 @@
+//! Binary sulog segments.
+//!
+//! A segment keeps the kernel frames verbatim (`EventRecordHeader` + payload)
+//! after a small file header. Every frame gets a fixed-size entry in a sidecar
+//! `.idx` file keyed by uid and wall-clock minute, so a query only scans the
+//! index and then reads the matching frames at their offsets.
+
+use anyhow::{Context, Result, ensure};
+use std::fs::{self, File, OpenOptions, Permissions};
+use std::io::Write;
+use std::os::unix::fs::{FileExt, OpenOptionsExt, PermissionsExt};
+use std::path::{Path, PathBuf};
+
+const SEGMENT_MAGIC: [u8; 8] = *b"KSULOGSG";
+const INDEX_MAGIC: [u8; 8] = *b"KSULOGIX";
+const FORMAT_VERSION: u32 = 1;
+const FILE_HEADER_LEN: usize = 16;
+const INDEX_ENTRY_LEN: usize = 16;
+const SEGMENT_FILE_MODE: u32 = 0o600;
+/// Size of the kernel `struct ksu_event_record_hdr`, checked against sulog.rs
+pub const FRAME_HEADER_LEN: usize = 24;
+/// Index uid for frames that do not belong to a process, e.g. dropped records
+pub const UID_NONE: u32 = u32::MAX;
+pub const SEGMENT_EXT: &str = ".seg";
+pub const INDEX_EXT: &str = ".idx";
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct IndexEntry {
+    pub uid: u32,
+    /// Minutes since the unix epoch when sulogd stored the frame
+    pub minute: u32,
+    pub offset: u64,
+}
+
+#[derive(Clone, Copy, Debug, Default)]
+pub struct QueryFilter {
+    pub uid: Option<u32>,
+    pub since_minute: Option<u32>,
+    pub until_minute: Option<u32>,
+}
+
+pub struct SegmentWriter {
+    dir: PathBuf,
+    day: String,
+    index: u32,
+    size: u64,
+    max_file_size: u64,
+    segment: File,
+    index_file: File,
+    /// Frames and index entries not yet written, see `flush`
+    pending_frames: Vec<u8>,
+    pending_index: Vec<u8>,
+}
+
+impl IndexEntry {
+    fn encode(self) -> [u8; INDEX_ENTRY_LEN] {
+        let mut bytes = [0u8; INDEX_ENTRY_LEN];
+        bytes[0..4].copy_from_slice(&self.uid.to_le_bytes());
+        bytes[4..8].copy_from_slice(&self.minute.to_le_bytes());
+        bytes[8..16].copy_from_slice(&self.offset.to_le_bytes());
+        bytes
+    }
+
+    fn decode(bytes: &[u8]) -> Self {
+        let mut uid = [0u8; 4];
+        let mut minute = [0u8; 4];
+        let mut offset = [0u8; 8];
+        uid.copy_from_slice(&bytes[0..4]);
+        minute.copy_from_slice(&bytes[4..8]);
+        offset.copy_from_slice(&bytes[8..16]);
+        Self {
+            uid: u32::from_le_bytes(uid),
+            minute: u32::from_le_bytes(minute),
+            offset: u64::from_le_bytes(offset),
+        }
+    }
+}
+
+impl QueryFilter {
+    fn matches(&self, entry: &IndexEntry) -> bool {
+        self.uid.is_none_or(|uid| uid == entry.uid)
+            && self.since_minute.is_none_or(|since| entry.minute >= since)
+            && self.until_minute.is_none_or(|until| entry.minute <= until)
+    }
+}
+
+fn file_header(magic: [u8; 8]) -> [u8; FILE_HEADER_LEN] {
+    let mut header = [0u8; FILE_HEADER_LEN];
+    header[..8].copy_from_slice(&magic);
+    header[8..12].copy_from_slice(&FORMAT_VERSION.to_le_bytes());
+    header
+}
+
+fn check_file_header(bytes: &[u8], magic: [u8; 8], path: &Path) -> Result<()> {
+    ensure!(
+        bytes.len() >= FILE_HEADER_LEN && bytes[..8] == magic,
+        "{} is not a sulog segment file",
+        path.display()
+    );
+    let mut version = [0u8; 4];
+    version.copy_from_slice(&bytes[8..12]);
+    let version = u32::from_le_bytes(version);
+    ensure!(
+        version == FORMAT_VERSION,
+        "{} has unsupported version {version}",
+        path.display()
+    );
+    Ok(())
+}
+
+pub fn segment_paths(dir: &Path, day: &str, index: u32) -> (PathBuf, PathBuf) {
+    let stem = if index == 0 {
+        format!("sulog-{day}")
+    } else {
+        format!("sulog-{day}-{index}")
+    };
+    (
+        dir.join(format!("{stem}{SEGMENT_EXT}")),
+        dir.join(format!("{stem}{INDEX_EXT}")),
+    )
+}
+
+/// Parse `sulog-YYYY-MM-DD[-N].seg` into (day, index)
+pub fn parse_segment_name(path: &Path) -> Option<(String, u32)> {
+    let name = path
+        .file_name()?
+        .to_str()?
+        .strip_prefix("sulog-")?
+        .strip_suffix(SEGMENT_EXT)?;
+    let day_len = "YYYY-MM-DD".len();
+    if name.len() == day_len {
+        return Some((name.to_string(), 0));
+    }
+    let (day, index) = name.split_at_checked(day_len)?;
+    let index = index.strip_prefix('-')?.parse::<u32>().ok()?;
+    Some((day.to_string(), index))
+}
+
+/// All segments in `dir` ordered by day and rotation index
+pub fn list_segments(dir: &Path) -> Result<Vec<(String, u32, PathBuf)>> {
+    let mut segments = Vec::new();
+    for entry in fs::read_dir(dir).with_context(|| format!("failed to read {}", dir.display()))? {
+        let path = entry
+            .with_context(|| format!("failed to read {}", dir.display()))?
+            .path();
+        if let Some((day, index)) = parse_segment_name(&path) {
+            segments.push((day, index, path));
+        }
+    }
+    segments.sort_by(|a, b| (&a.0, a.1).cmp(&(&b.0, b.1)));
+    Ok(segments)
+}
+
+fn open_append(path: &Path, magic: [u8; 8]) -> Result<(File, u64)> {
+    let mut file = OpenOptions::new()
+        .create(true)
+        .append(true)
+        .mode(SEGMENT_FILE_MODE)
+        .open(path)
+        .with_context(|| format!("failed to open {}", path.display()))?;
+    file.set_permissions(Permissions::from_mode(SEGMENT_FILE_MODE))
+        .with_context(|| format!("failed to chmod {}", path.display()))?;
+    let mut size = file
+        .metadata()
+        .with_context(|| format!("failed to stat {}", path.display()))?
+        .len();
+    if size == 0 {
+        file.write_all(&file_header(magic))
+            .with_context(|| format!("failed to write header to {}", path.display()))?;
+        size = FILE_HEADER_LEN as u64;
+    }
+    Ok((file, size))
+}
+
+impl SegmentWriter {
+    pub fn open(dir: &Path, day: &str, max_file_size: u64) -> Result<Self> {
+        let mut index = list_segments(dir)?
+            .into_iter()
+            .filter(|(segment_day, _, _)| segment_day == day)
+            .map(|(_, index, _)| index)
+            .max()
+            .unwrap_or(0);
+        let (segment_path, _) = segment_paths(dir, day, index);
+        let existing = fs::metadata(&segment_path).map_or(0, |meta| meta.len());
+        if existing >= max_file_size && existing > 0 {
+            index = index.saturating_add(1);
+        }
+
+        let (segment_path, index_path) = segment_paths(dir, day, index);
+        let (segment, size) = open_append(&segment_path, SEGMENT_MAGIC)?;
+        let (index_file, _) = open_append(&index_path, INDEX_MAGIC)?;
+        Ok(Self {
+            dir: dir.to_path_buf(),
+            day: day.to_string(),
+            index,
+            size,
+            max_file_size,
+            segment,
+            index_file,
+            pending_frames: Vec::new(),
+            pending_index: Vec::new(),
+        })
+    }
+
+    fn rotate(&mut self) -> Result<()> {
+        self.flush()?;
+        self.index = self.index.saturating_add(1);
+        let (segment_path, index_path) = segment_paths(&self.dir, &self.day, self.index);
+        let (segment, size) = open_append(&segment_path, SEGMENT_MAGIC)?;
+        let (index_file, _) = open_append(&index_path, INDEX_MAGIC)?;
+        self.segment = segment;
+        self.index_file = index_file;
+        self.size = size;
+        Ok(())
+    }
+
+    /// Bytes buffered by `append` that are not on disk yet
+    pub const fn pending_len(&self) -> usize {
+        self.pending_frames.len() + self.pending_index.len()
+    }
+
+    /// Write out everything buffered by `append`
+    pub fn flush(&mut self) -> Result<()> {
+        // frames first, so an index entry never points past the data after a crash
+        if !self.pending_frames.is_empty() {
+            self.segment
+                .write_all(&self.pending_frames)
+                .context("failed to write sulog segment frames")?;
+            self.pending_frames.clear();
+        }
+        if !self.pending_index.is_empty() {
+            self.index_file
+                .write_all(&self.pending_index)
+                .context("failed to write sulog segment index")?;
+            self.pending_index.clear();
+        }
+        Ok(())
+    }
+
+    /// Flush and make the current segment and index durable
+    pub fn sync(&mut self) -> Result<()> {
+        self.flush()?;
+        self.segment
+            .sync_data()
+            .context("failed to sync sulog segment")?;
+        self.index_file
+            .sync_data()
+            .context("failed to sync sulog segment index")?;
+        Ok(())
+    }
+
+    /// Queue one raw kernel frame and its index entry, call `flush` to write them
+    pub fn append(&mut self, frame: &[u8], uid: u32, minute: u32) -> Result<()> {
+        let frame_len = frame.len() as u64;
+        if self.size > FILE_HEADER_LEN as u64
+            && self.size.saturating_add(frame_len) > self.max_file_size
+        {
+            self.rotate()?;
+        }
+
+        let entry = IndexEntry {
+            uid,
+            minute,
+            offset: self.size,
+        };
+        self.pending_frames.extend_from_slice(frame);
+        self.pending_index.extend_from_slice(&entry.encode());
+        self.size = self.size.saturating_add(frame_len);
+        Ok(())
+    }
+}
+
+impl Drop for SegmentWriter {
+    fn drop(&mut self) {
+        if let Err(err) = self.flush() {
+            log::warn!("failed to flush sulog segment on close: {err:#}");
+        }
+    }
+}
+
+/// Read the index of one segment
+pub fn read_index(index_path: &Path) -> Result<Vec<IndexEntry>> {
+    let bytes =
+        fs::read(index_path).with_context(|| format!("failed to read {}", index_path.display()))?;
+    check_file_header(&bytes, INDEX_MAGIC, index_path)?;
+    // a torn trailing entry is ignored
+    Ok(bytes[FILE_HEADER_LEN..]
+        .chunks_exact(INDEX_ENTRY_LEN)
+        .map(IndexEntry::decode)
+        .collect())
+}
+
+/// Call `visit` with every frame of the segment whose index entry matches.
+/// `visit` returns false to stop early, which is reported back to the caller.
+pub fn query_segment<F>(segment_path: &Path, filter: &QueryFilter, mut visit: F) -> Result<bool>
+where
+    F: FnMut(&IndexEntry, &[u8]) -> Result<bool>,
+{
+    let index_path = segment_path.with_extension(&INDEX_EXT[1..]);
+    let entries = read_index(&index_path)?;
+    let segment = File::open(segment_path)
+        .with_context(|| format!("failed to open {}", segment_path.display()))?;
+    let segment_len = segment
+        .metadata()
+        .with_context(|| format!("failed to stat {}", segment_path.display()))?
+        .len();
+
+    let mut header = [0u8; FILE_HEADER_LEN];
+    segment
+        .read_exact_at(&mut header, 0)
+        .with_context(|| format!("failed to read {}", segment_path.display()))?;
+    check_file_header(&header, SEGMENT_MAGIC, segment_path)?;
+
+    let mut frame = Vec::new();
+    for entry in entries.iter().filter(|entry| filter.matches(entry)) {
+        let Some(payload_offset) = entry.offset.checked_add(FRAME_HEADER_LEN as u64) else {
+            continue;
+        };
+        if payload_offset > segment_len {
+            log::warn!(
+                "sulog index entry past end of {} at {}",
+                segment_path.display(),
+                entry.offset
+            );
+            continue;
+        }
+
+        frame.resize(FRAME_HEADER_LEN, 0);
+        segment
+            .read_exact_at(&mut frame, entry.offset)
+            .with_context(|| format!("failed to read {}", segment_path.display()))?;
+        let mut payload_len = [0u8; 4];
+        payload_len.copy_from_slice(&frame[4..8]);
+        let payload_len = u64::from(u32::from_ne_bytes(payload_len));
+        if payload_offset.saturating_add(payload_len) > segment_len {
+            log::warn!(
+                "sulog frame truncated in {} at {}",
+                segment_path.display(),
+                entry.offset
+            );
+            continue;
+        }
+
+        frame.resize(FRAME_HEADER_LEN + payload_len as usize, 0);
+        segment
+            .read_exact_at(&mut frame[FRAME_HEADER_LEN..], payload_offset)
+            .with_context(|| format!("failed to read {}", segment_path.display()))?;
+        if !visit(entry, &frame)? {
+            return Ok(false);
+        }
+    }
+    Ok(true)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn frame(seq: u64, payload: &[u8]) -> Vec<u8> {
+        let mut frame = Vec::with_capacity(FRAME_HEADER_LEN + payload.len());
+        frame.extend_from_slice(&1u16.to_ne_bytes());
+        frame.extend_from_slice(&0u16.to_ne_bytes());
+        frame.extend_from_slice(&u32::try_from(payload.len()).unwrap().to_ne_bytes());
+        frame.extend_from_slice(&seq.to_ne_bytes());
+        frame.extend_from_slice(&seq.to_ne_bytes());
+        frame.extend_from_slice(payload);
+        frame
+    }
+
+    fn collect(dir: &Path, filter: &QueryFilter) -> Vec<(IndexEntry, Vec<u8>)> {
+        let mut found = Vec::new();
+        for (_, _, path) in list_segments(dir).unwrap() {
+            query_segment(&path, filter, |entry, frame| {
+                found.push((*entry, frame.to_vec()));
+                Ok(true)
+            })
+            .unwrap();
+        }
+        found
+    }
+
+    #[test]
+    fn query_by_uid_and_minute_returns_exact_frames() {
+        let dir = tempfile::tempdir().unwrap();
+        let mut writer = SegmentWriter::open(dir.path(), "2026-01-02", 1 << 20).unwrap();
+        let frames = [
+            (1000, 10, frame(1, b"first")),
+            (2000, 11, frame(2, b"second")),
+            (1000, 12, frame(3, b"third")),
+            (UID_NONE, 12, frame(4, b"")),
+        ];
+        for (uid, minute, frame) in &frames {
+            writer.append(frame, *uid, *minute).unwrap();
+        }
+        assert!(collect(dir.path(), &QueryFilter::default()).is_empty());
+        writer.flush().unwrap();
+
+        let by_uid = collect(
+            dir.path(),
+            &QueryFilter {
+                uid: Some(1000),
+                ..QueryFilter::default()
+            },
+        );
+        assert_eq!(by_uid.len(), 2);
+        assert_eq!(by_uid[0].1, frames[0].2);
+        assert_eq!(by_uid[1].1, frames[2].2);
+
+        let by_time = collect(
+            dir.path(),
+            &QueryFilter {
+                since_minute: Some(11),
+                until_minute: Some(11),
+                ..QueryFilter::default()
+            },
+        );
+        assert_eq!(by_time.len(), 1);
+        assert_eq!(by_time[0].0.uid, 2000);
+        assert_eq!(by_time[0].1, frames[1].2);
+
+        assert_eq!(collect(dir.path(), &QueryFilter::default()).len(), 4);
+    }
+
+    #[test]
+    fn rotation_keeps_offsets_per_segment_and_reopen_appends() {
+        let dir = tempfile::tempdir().unwrap();
+        let payload = [0x5au8; 64];
+        let frame_len = (FRAME_HEADER_LEN + payload.len()) as u64;
+        let max_size = FILE_HEADER_LEN as u64 + frame_len * 2;
+
+        let mut writer = SegmentWriter::open(dir.path(), "2026-01-03", max_size).unwrap();
+        for seq in 0..5 {
+            writer.append(&frame(seq, &payload), 1000, 1).unwrap();
+        }
+        drop(writer);
+        let mut writer = SegmentWriter::open(dir.path(), "2026-01-03", max_size).unwrap();
+        writer.append(&frame(5, &payload), 1000, 1).unwrap();
+        writer.flush().unwrap();
+
+        let segments = list_segments(dir.path()).unwrap();
+        assert_eq!(segments.len(), 3);
+        assert_eq!(
+            parse_segment_name(&segments[2].2),
+            Some(("2026-01-03".to_string(), 2))
+        );
+
+        let found = collect(dir.path(), &QueryFilter::default());
+        let seqs: Vec<u64> = found
+            .iter()
+            .map(|(_, frame)| {
+                let mut seq = [0u8; 8];
+                seq.copy_from_slice(&frame[8..16]);
+                u64::from_ne_bytes(seq)
+            })
+            .collect();
+        assert_eq!(seqs, vec![0, 1, 2, 3, 4, 5]);
+    }
+
+    #[test]
+    fn truncated_tail_is_skipped() {
+        let dir = tempfile::tempdir().unwrap();
+        let mut writer = SegmentWriter::open(dir.path(), "2026-01-04", 1 << 20).unwrap();
+        writer.append(&frame(1, b"kept"), 1000, 1).unwrap();
+        writer.append(&frame(2, b"torn payload"), 1000, 1).unwrap();
+        drop(writer);
+
+        let (segment_path, _) = segment_paths(dir.path(), "2026-01-04", 0);
+        let len = fs::metadata(&segment_path).unwrap().len();
+        OpenOptions::new()
+            .write(true)
+            .open(&segment_path)
+            .unwrap()
+            .set_len(len - 4)
+            .unwrap();
+
+        let found = collect(dir.path(), &QueryFilter::default());
+        assert_eq!(found.len(), 1);
+        assert_eq!(found[0].1, frame(1, b"kept"));
+    }
+}